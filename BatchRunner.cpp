@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "BatchRunner.h"
+
+namespace {
+   bool isVideoFile( const std::string& name ) {
+      static const char* extensions[] = { ".avi", ".mp4", ".mkv", ".mov", ".mpg", ".mpeg", ".wmv", ".webm", ".flv" };
+      const size_t dot = name.rfind( '.' );
+      if ( dot == std::string::npos ) {
+         return false;
+      }
+      std::string extension = name.substr( dot );
+      std::transform( extension.begin(), extension.end(), extension.begin(), ::tolower );
+      for ( const char* elem: extensions ) {
+         if ( extension == elem ) {
+            return true;
+         }
+      }
+      return false;
+   }
+}
+
+BatchRunner::BatchRunner( int numOfWorkers, std::ostream& log )
+ : numOfWorkers_( std::max( numOfWorkers, 1 ) ), log_( log )
+{}
+
+std::vector<BatchRunner::Result>
+BatchRunner::run( const std::vector<std::string>& inputs, const Job& job ) {
+   std::vector<Result> results( inputs.size() );
+   std::atomic<size_t> next( 0 );
+   std::mutex logMutex;
+
+   auto worker = [&]() {
+      for ( size_t i = next++; i < inputs.size(); i = next++ ) {
+         Result& result = results[i];
+         result.input = inputs[i];
+         std::ostringstream jobLog;
+         const auto start = std::chrono::steady_clock::now();
+         // a broken input fails only its own result, an exception escaping the thread would end the batch
+         try {
+            result.success = job( inputs[i], jobLog, result.numOfFrames );
+         } catch ( const std::exception& e ) {
+            jobLog << "Failed: " << e.what() << std::endl;
+            result.success = false;
+         } catch ( ... ) {
+            jobLog << "Failed: unknown exception" << std::endl;
+            result.success = false;
+         }
+         result.seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+         std::lock_guard<std::mutex> lock( logMutex );
+         std::istringstream lines( jobLog.str() );
+         std::string line;
+         while ( std::getline( lines, line ) ) {
+            log_ << "[" << inputs[i] << "] " << line << std::endl;
+         }
+      }
+   };
+
+   const auto start = std::chrono::steady_clock::now();
+   std::vector<std::thread> workers;
+   for ( int i = 0; i < numOfWorkers_ && i < static_cast<int>( inputs.size() ); ++i ) {
+      workers.push_back( std::thread( worker ) );
+   }
+   for ( std::thread& elem: workers ) {
+      elem.join();
+   }
+   wallSeconds_ = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+   return results;
+}
+
+void
+BatchRunner::printSummary( const std::vector<Result>& results ) const {
+   long totalFrames = 0;
+   int failed = 0;
+   log_ << std::left << std::setw(40) << "INPUT" << std::right << std::setw(10) << "FRAMES" << std::setw(10) << "SECONDS" << std::setw(10) << "FPS" << "  STATUS" << std::endl;
+   for ( const Result& elem: results ) {
+      log_ << std::left << std::setw(40) << elem.input << std::right << std::setw(10) << elem.numOfFrames
+           << std::fixed << std::setprecision(1) << std::setw(10) << elem.seconds
+           << std::setw(10) << ( elem.seconds > 0. ? elem.numOfFrames / elem.seconds : 0. )
+           << "  " << ( elem.success ? "ok" : "FAILED" ) << std::endl;
+      totalFrames += elem.numOfFrames;
+      failed += !elem.success;
+   }
+   log_ << results.size() << " videos, " << failed << " failed, " << totalFrames << " frames in "
+        << std::fixed << std::setprecision(1) << wallSeconds_ << " s on " << numOfWorkers_ << " workers, "
+        << ( wallSeconds_ > 0. ? totalFrames / wallSeconds_ : 0. ) << " fps" << std::endl;
+}
+
+bool
+BatchRunner::listInputs( const std::string& path, std::vector<std::string>& inputs ) {
+   struct stat info;
+   if ( stat( path.c_str(), &info ) != 0 ) {
+      return false;
+   }
+
+   if ( S_ISDIR( info.st_mode ) ) {
+      DIR* dir = opendir( path.c_str() );
+      if ( !dir ) {
+         return false;
+      }
+      while ( dirent* entry = readdir( dir ) ) {
+         const std::string name = entry->d_name;
+         const std::string fullPath = path + "/" + name;
+         if ( isVideoFile( name ) && stat( fullPath.c_str(), &info ) == 0 && S_ISREG( info.st_mode ) ) {
+            inputs.push_back( fullPath );
+         }
+      }
+      closedir( dir );
+      std::sort( inputs.begin(), inputs.end() );
+      return true;
+   }
+
+   // a list file, one input per line, # starts a comment
+   std::ifstream list( path.c_str() );
+   std::string line;
+   while ( std::getline( list, line ) ) {
+      if ( !line.empty() && line[0] != '#' ) {
+         inputs.push_back( line );
+      }
+   }
+   return !list.bad();
+}
+
+std::string
+BatchRunner::getStem( const std::string& path ) {
+   const size_t slash = path.rfind( '/' );
+   std::string name = slash == std::string::npos ? path : path.substr( slash + 1 );
+   const size_t dot = name.rfind( '.' );
+   if ( dot != std::string::npos && dot > 0 ) {
+      name = name.substr( 0, dot );
+   }
+   return name;
+}
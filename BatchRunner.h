@@ -0,0 +1,43 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Runs a job for every input on a fixed number of worker threads. The log of a job is collected
+// into a string and printed in one piece when the job is done, so the logs of the parallel jobs
+// don't get mixed.
+class BatchRunner {
+public:
+   // Returns false on failure, numOfFrames is used for the throughput
+   typedef std::function<bool( const std::string& input, std::ostream& log, long& numOfFrames )> Job;
+
+   struct Result {
+      std::string input;
+      bool success = false;
+      long numOfFrames = 0;
+      double seconds = 0.;
+   };
+
+   BatchRunner( int numOfWorkers, std::ostream& log );
+
+   std::vector<Result> run( const std::vector<std::string>& inputs, const Job& job );
+
+   // Per input throughput and the totals
+   void printSummary( const std::vector<Result>& results ) const;
+
+   // The video files of a directory in alphabetical order, or the lines of a list file
+   static bool listInputs( const std::string& path, std::vector<std::string>& inputs );
+
+   // The file name without the directory and the extension
+   static std::string getStem( const std::string& path );
+
+private:
+   const int numOfWorkers_;
+   std::ostream& log_;
+   double wallSeconds_ = 0.;
+};
+
+#endif /* BATCHRUNNER_H */
@@ -0,0 +1,599 @@
+#ifndef CARPROCESSOR_H
+#define CARPROCESSOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "ImageProcessor.h"
+#include "Panorama.h"
+#include "Profiler.h"
+#include "TrajectoryWriter.h"
+
+// Finds the car on the frames against the panorama, its position and orientation
+class CarProcessor : public ImageProcessor {
+   public:
+      // The positions are reported relative to the origin given in the coordinates of the panorama,
+      // e.g. the top left corner of the exported background image
+      CarProcessor( const std::vector<cv::Vec2f>& trajectory,
+                    const Panorama& background,
+                    const cv::Mat& sbpResult,
+                    const cv::Point& origin )
+       : trajectory_( trajectory ),
+         background_( background ),
+         sbpResult_( sbpResult ),
+         centroidDistorted_( sbpResult.cols / 2, sbpResult.rows / 2 ),
+         origin_( origin ),
+         ax_( 0 ),
+         ay_( 0 )
+      {
+      }
+
+      virtual bool process( const cv::Mat& frame, bool dropped ) override {
+         // the shifts of the frames without a row are carried to the next row
+         for ( int i = 0; i < stride_; ++i, ++index_ ) {
+            if ( index_ < static_cast<int>( trajectory_.size() ) ) {
+               short int dx = trajectory_[ index_ ][0];
+               short int dy = trajectory_[ index_ ][1];
+               ax_ += dx;
+               ay_ += dy;
+               frameShift_[0] += dx;
+               frameShift_[1] += dy;
+            }
+         }
+
+         if ( !dropped ) {
+            if (frame.empty()) {
+                return false;
+            }
+            const cv::Rect frameRect( 0, 0, frame.cols, frame.rows );
+            bool tracked = false;
+            if ( roiMargin_ > 0 && lastBlobRect_.area() > 0 ) {
+               // the blob can grow to twice of its size and move by the margin
+               const int growx = lastBlobRect_.width / 2 + roiMargin_;
+               const int growy = lastBlobRect_.height / 2 + roiMargin_;
+               const cv::Rect roi = cv::Rect( lastBlobRect_.x - growx, lastBlobRect_.y - growy,
+                                              lastBlobRect_.width + 2 * growx, lastBlobRect_.height + 2 * growy ) & frameRect;
+               tracked = processRegion( frame, roi, true );
+               if ( !tracked ) {
+                  ++numOfRoiFallbacks_;
+               }
+            }
+            if ( !tracked ) {
+               processRegion( frame, frameRect, false );
+            }
+         }
+
+         ImageProcessor::process( frame, dropped );
+        
+         return true;
+      }
+      virtual std::string getTitle() const override { return "Processing"; }
+      // Every row is passed to the writer as soon as it is final
+      void setWriter( TrajectoryWriter* pWriter ) { pWriter_ = pWriter; }
+
+      // Every frame given to process() is stride shifts of the trajectory after the previous one,
+      // a shift is framesPerShift frames of the video. The rows are numbered by the frames of the
+      // video from 0, like the synthetic ground truth, the ones in between two detections are
+      // interpolated. A row carries the shift of the background since the previous row, so the
+      // frames where the car was lost or dropped don't lose their shifts, their sum is on the next
+      // detection.
+      void setStride( int stride, int framesPerShift ) {
+         stride_ = stride;
+         framesPerShift_ = framesPerShift;
+      }
+
+      // Only the surroundings of the last detection are processed, 0 disables the tracking
+      void setRoiMargin( int margin ) { roiMargin_ = margin; }
+      long getNumOfRoiFallbacks() const { return numOfRoiFallbacks_; }
+
+      // The first n shifts were removed from the trajectory, so a long run doesn't keep all of them
+      int getNumOfConsumedShifts() const { return index_; }
+      void forgetShifts( int n ) {
+         index_ -= n;
+         numOfForgottenShifts_ += n;
+      }
+
+   private:
+      // the kernels are measured one by one in processor_bench
+      friend class ProcessorBenchmark;
+
+      // Returns false without touching the state if the car isn't found in the region, or if it
+      // may be cut by the border of the region when tracking
+      bool processRegion( const cv::Mat& fullFrame, const cv::Rect& roi, bool tracking ) {
+         PROFILE_SCOPE( "car region" );
+         const cv::Mat frame = fullFrame( roi );
+         const cv::Mat sbpResult = sbpResult_( roi );
+         cv::Mat backgroundSlice = background_.getSlice( cv::Rect( ax_ + roi.x, ay_ + roi.y, frame.cols, frame.rows ) );
+
+         // creating diff in HSV
+         cv::Mat hsvFrame( frame.size(), CV_8UC3 );
+         cv::Mat diff(frame.size(), frame.type());
+         {
+            PROFILE_SCOPE( "hsv diff" );
+            cv::cvtColor( frame, hsvFrame, CV_RGB2HSV );
+            cv::Mat hsvBackgroundSlice( backgroundSlice.size(), CV_8UC3 );
+            cv::cvtColor( backgroundSlice, hsvBackgroundSlice, CV_RGB2HSV );
+            cv::absdiff( hsvFrame, hsvBackgroundSlice, diff );
+         }
+
+         // breaking it into channels
+         std::vector<cv::Mat> diffChannels(3);
+         cv::split(diff, diffChannels);
+
+         // threshold
+         cv::Mat binaryMaskMat(frame.size(), CV_8U);
+         cv::threshold(diffChannels[0], binaryMaskMat, 20, 255, cv::THRESH_BINARY);
+         cv::bitwise_not( binaryMaskMat, binaryMaskMat );
+
+         // better approach for map
+         std::vector<cv::Mat> hsvFrameChannels(3);
+         cv::split(hsvFrame, hsvFrameChannels);
+         createColorDistribution( hsvFrameChannels[0], binaryMaskMat, 255, backgroundHues_ );
+         cv::Mat binaryMaskMatCarColor;
+
+         cv::bitwise_or( binaryMaskMat, sbpResult, binaryMaskMat );
+         cv::bitwise_not( binaryMaskMat, binaryMaskMat );
+
+         cv::Point elem;
+         cv::Mat carColorDebug; // shown only if this attempt is kept, a failed tracking is retried on the whole frame
+         if ( createColorMask( binaryMaskMatCarColor, hsvFrameChannels[0], backgroundHues_ ) ) {
+            cv::bitwise_or( binaryMaskMatCarColor, sbpResult, binaryMaskMatCarColor );
+            cv::bitwise_not( binaryMaskMatCarColor, binaryMaskMatCarColor );
+
+            // detecting our blob
+            elem = findNearestBlobInBinaryImage( binaryMaskMatCarColor, centroidDistorted_, roi, fullFrame.size() );
+            if ( isDebugEnabled() ) {
+               carColorDebug = placeInFrame( binaryMaskMatCarColor, roi.tl(), fullFrame.size() );
+            }
+         } else {
+            elem = findNearestBlobInBinaryImage( binaryMaskMat, centroidDistorted_, roi, fullFrame.size() );
+         }
+
+         // distortion removal, basic version, TODO: improve
+         const double distortion = static_cast<double>( fullFrame.cols ) * 3. / 4. / static_cast<double>( fullFrame.rows );
+         cv::Size undistortedSize( binaryMaskMat.cols, binaryMaskMat.rows * distortion );
+         const cv::Point undistortedRoiPos( roi.x, roi.y * distortion );
+
+         if ( elem != cv::Point( 0, 0 ) ) {
+            // the mask has no 127 pixels before, so only the filled rect has to be scanned
+            cv::Rect filledRect;
+            cv::floodFill( binaryMaskMat, elem - roi.tl(), cvScalar(127.0), &filledRect );
+            if ( tracking && touchesInnerBorder( filledRect, roi, fullFrame.size() ) ) {
+               return false; // the car may be cut, searching it on the whole frame
+            }
+            lastBlobRect_ = filledRect + roi.tl();
+            cv::Point2d centroidDistorted = calculateBlobStats( binaryMaskMat, filledRect ).centroid + cv::Point2d( roi.tl() );
+
+            // remove distortion, the interpolation may create 127 pixels anywhere
+            cv::resize( binaryMaskMat, binaryMaskMat, undistortedSize );
+            const BlobStats blob = calculateBlobStats( binaryMaskMat, cv::Rect( 0, 0, binaryMaskMat.cols, binaryMaskMat.rows ), true );
+            cv::Point2d centroid = blob.centroid;
+            const long area = blob.area;
+            averageArea_ = ( averageArea_ * areaSamples_ + area ) / ( areaSamples_ + 1 );
+            ++areaSamples_;
+            const bool validArea = ( area > averageArea_ / 1.25 ) && ( area < averageArea_ * 1.25 );
+            // absolute position
+            cv::Point2d absPos( ax_ - origin_.x + centroidDistorted.x, ( ay_ - origin_.y + centroidDistorted.y ) * distortion );
+
+            // orientation
+            const double rawAngle = 0.5 * atan( 2.0 * blob.mu11 / ( blob.mu20 - blob.mu02 ) );
+            const double signOfAngle = calculateSignOfAngle( blob, centroid, rawAngle );
+            const double jOfAngle = calculateJ( blob, centroid, rawAngle, signOfAngle );
+            cv::Point2d helper = angleVect_;
+            bool validHelper = false;
+            if ( places_.size() > 10 ) {
+               helper = places_[ places_.size() - 1 ] - places_[ places_.size() - 10 ];
+               validHelper = true;
+            }
+
+            const double kOfAngle = estimateKWithHelper( helper, rawAngle, signOfAngle, jOfAngle ); // couldn't calculate K in an exact way
+
+            double angle = correctInterval( signOfAngle * rawAngle + PI / 2. * jOfAngle + PI * kOfAngle );
+            bool validAngle = false;
+
+            // preserving important data
+            if ( validArea && validHelper 
+                 && ( ( angleVect_.x == 0. && angleVect_.y == 0. )
+                      || ( angleVect_.x * cos( angle )  + angleVect_.y * sin( angle ) > 0.85 )
+                      || ( validAreaCounter_ == 2 ) ) )
+            {
+               angleVect_ = cv::Point2d( cos( angle ), sin( angle ) );
+               validAngle = true;
+            } else {
+               if ( hasLastAngle_ ) {
+                  angle = lastAngle_; // error correction
+               }
+            }
+            lastAngle_ = angle;
+            hasLastAngle_ = true;
+            places_.push_back( absPos  );
+            if ( places_.size() > MAX_NUM_OF_PLACES ) {
+               places_.pop_front();
+            }
+            writeRow( TrajectoryRow{ absPos.x, absPos.y, angle, validAngle, ( numOfForgottenShifts_ + index_ ) * framesPerShift_,
+                                     frameShift_[0], frameShift_[1] } );
+            frameShift_ = cv::Vec2f( 0, 0 );
+            if ( validArea && validHelper ) {
+               ++validAreaCounter_;
+            } else {
+               validAreaCounter_ = 0;
+            }
+            centroidDistorted_ = centroidDistorted;
+            centroid_ = centroid;
+
+            // drawing debug data
+            if ( isDebugEnabled() ) {
+               if ( validAngle ) {
+                  cv::Point2d rad( 5, 5 );
+                  cv::rectangle( binaryMaskMat, centroid - rad, centroid + rad, cvScalar(255.0) );
+               } else {
+                  cv::circle( binaryMaskMat, centroid_, 5, cvScalar(255.0) );
+               }
+
+               // visualizing the motion vector == the change of position on the last 10 frames.
+               {
+                  cv::Point2d endPointOfMotionVector = centroid;
+                  if ( places_.size() > 10 ) {
+                     endPointOfMotionVector += places_[ places_.size() - 1 ] - places_[ places_.size() - 10 ];
+                  }
+                  cv::circle( binaryMaskMat, endPointOfMotionVector, 3, cvScalar(32.0) );
+               }
+
+               cv::Point2d dir ( cos( angle + PI ), sin( angle + PI ) );
+               cv::line( binaryMaskMat, centroid, centroid + cv::Point2d( 30. * dir ), cvScalar(255.0) );
+            }
+
+         } else {
+            if ( tracking ) {
+               return false;
+            }
+            lastBlobRect_ = cv::Rect();
+            centroidDistorted_ = estimateCentroid( binaryMaskMat );
+            cv::resize( binaryMaskMat, binaryMaskMat, undistortedSize );
+            centroid_ = estimateCentroid( binaryMaskMat );
+            if ( isDebugEnabled() ) {
+               cv::circle( binaryMaskMat, centroid_, 5, cvScalar(255.0) );
+            }
+         }
+         if ( isDebugEnabled() ) {
+            if ( !carColorDebug.empty() ) {
+               showDebug( "carcolor", carColorDebug );
+            }
+            showDebug( "binary" , placeInFrame( binaryMaskMat, undistortedRoiPos, cv::Size( fullFrame.cols, fullFrame.rows * distortion ) ) );
+         }
+         return true;
+      }
+
+      // The center and the result are in the coordinates of the frame, img covers the roi only.
+      // Squares of growing radius are searched column by column, and as the inside of a square
+      // was already searched with the smaller radius, only its ring has to be visited.
+      cv::Point findNearestBlobInBinaryImage( const cv::Mat& img, const cv::Point center, const cv::Rect& roi, const cv::Size& frameSize ) {
+         PROFILE_SCOPE( "findNearestBlob" );
+         const int border = 20;
+         int cx = center.x;
+         int cy = center.y;
+         int maxrad = ( cx < cy ? cx : cy );
+         if ( maxrad <= 0 ) {
+            return cv::Point( 0, 0 );
+         }
+
+         // the searched pixels, in the coordinates of the frame
+         const cv::Rect valid = cv::Rect( border + 1, border + 1, frameSize.width - 2 * border - 1, frameSize.height - 2 * border - 1 )
+                              & roi
+                              & cv::Rect( cx - maxrad + 1, cy - maxrad + 1, 2 * maxrad - 1, 2 * maxrad - 1 );
+         if ( valid.area() <= 0 || !cv::countNonZero( img( valid - roi.tl() ) == 255 ) ) {
+            return cv::Point( 0, 0 );
+         }
+         const int minx = valid.x, maxx = valid.x + valid.width - 1;
+         const int miny = valid.y, maxy = valid.y + valid.height - 1;
+         auto isBlob = [&]( int x, int y ) { return img.at<unsigned char>( y - roi.y, x - roi.x ) == 255; };
+
+         for ( int radius = 0; radius < maxrad; ++radius ) {
+            for ( int x = std::max( cx - radius, minx ); x <= std::min( cx + radius, maxx ); ++x ) {
+               if ( x == cx - radius || x == cx + radius ) {
+                  for ( int y = std::max( cy - radius, miny ); y <= std::min( cy + radius, maxy ); ++y ) {
+                     if ( isBlob( x, y ) ) {
+                        return cv::Point( x, y );
+                     }
+                  }
+               } else {
+                  if ( miny <= cy - radius && cy - radius <= maxy && isBlob( x, cy - radius ) ) {
+                     return cv::Point( x, cy - radius );
+                  }
+                  if ( miny <= cy + radius && cy + radius <= maxy && isBlob( x, cy + radius ) ) {
+                     return cv::Point( x, cy + radius );
+                  }
+               }
+            }
+         }
+         return cv::Point( 0, 0 );
+      }
+
+      // The sides of the roi on the border of the frame don't count
+      bool touchesInnerBorder( const cv::Rect& rect, const cv::Rect& roi, const cv::Size& frameSize ) const {
+         return ( rect.x == 0 && roi.x > 0 )
+             || ( rect.y == 0 && roi.y > 0 )
+             || ( rect.x + rect.width == roi.width && roi.x + roi.width < frameSize.width )
+             || ( rect.y + rect.height == roi.height && roi.y + roi.height < frameSize.height );
+      }
+
+      // The debug streams always get full frames
+      cv::Mat placeInFrame( const cv::Mat& img, const cv::Point& pos, const cv::Size& size ) const {
+         if ( img.size() == size ) {
+            return img;
+         }
+         cv::Mat result = cv::Mat::zeros( size, img.type() );
+         const cv::Rect rect = cv::Rect( pos, img.size() ) & cv::Rect( cv::Point( 0, 0 ), size );
+         img( cv::Rect( rect.tl() - pos, rect.size() ) ).copyTo( result( rect ) );
+         return result;
+      }
+
+      cv::Point2d estimateCentroid( const cv::Mat& img ) {
+         cv::Point2d lower( img.cols-1, img.rows-1);
+         cv::Point2d upper( 0.0, 0.0 );
+
+         for ( int x = 0; x < img.cols; ++x ) {
+            for ( int y = 0; y < img.rows; ++y ) {
+               if ( img.at<unsigned char>( y, x ) > 0 ) {
+                  if ( x > upper.x ) {
+                     upper.x = x;
+                  }
+                  if ( x < lower.x ) {
+                     lower.x = x;
+                  }
+                  if ( y > upper.y ) {
+                     upper.y = y;
+                  }
+                  if ( y < lower.y ) {
+                     lower.y = y;
+                  }
+               }
+            }
+         }
+
+         return ( lower + upper ) / 2.;
+      }
+
+      // Everything the tracking needs from the blob, collected in one row major pass. The second
+      // order moments are taken around the rounded centroid, as they always were. On request the
+      // pixels are kept too, as a list and as a bitmap over the bounding box, so the orientation
+      // tests don't have to scan the image again.
+      struct BlobStats {
+         long area = 0;
+         cv::Point2d centroid;
+         double mu20 = 0.;
+         double mu02 = 0.;
+         double mu11 = 0.;
+         cv::Rect boundingBox;
+         std::vector<cv::Point> pixels;
+         cv::Mat bitmap;
+
+         bool contains( int x, int y ) const {
+            return boundingBox.contains( cv::Point( x, y ) ) && bitmap.at<unsigned char>( y - boundingBox.y, x - boundingBox.x );
+         }
+      };
+
+      BlobStats calculateBlobStats( const cv::Mat& img, const cv::Rect& rect, bool collectPixels = false, unsigned char color = 127 ) const {
+         PROFILE_SCOPE( "blob stats" );
+         BlobStats stats;
+         // integer sums are exact, so the moments don't depend on the order of the pixels
+         long long sumx = 0, sumy = 0, sumxx = 0, sumyy = 0, sumxy = 0;
+         long num = 0;
+         int minx = rect.x + rect.width, miny = rect.y + rect.height, maxx = rect.x - 1, maxy = rect.y - 1;
+
+         for ( int y = rect.y; y < rect.y + rect.height; ++y ) {
+            const unsigned char* row = img.ptr<unsigned char>( y );
+            long long rowNum = 0, rowSumx = 0, rowSumxx = 0;
+            for ( int x = rect.x; x < rect.x + rect.width; ++x ) {
+               if ( row[x] == color ) {
+                  if ( collectPixels ) {
+                     stats.pixels.push_back( cv::Point( x, y ) );
+                  }
+                  ++rowNum;
+                  rowSumx += x;
+                  rowSumxx += x * x;
+                  minx = std::min( minx, x );
+                  maxx = std::max( maxx, x );
+               }
+            }
+            if ( rowNum ) {
+               num += rowNum;
+               sumx += rowSumx;
+               sumxx += rowSumxx;
+               sumy += rowNum * y;
+               sumyy += rowNum * y * y;
+               sumxy += rowSumx * y;
+               miny = std::min( miny, y );
+               maxy = y;
+            }
+         }
+
+         stats.area = num;
+         stats.centroid = cv::Point2d( static_cast<double>( sumx ) / num, static_cast<double>( sumy ) / num );
+         if ( num ) {
+            stats.boundingBox = cv::Rect( minx, miny, maxx - minx + 1, maxy - miny + 1 );
+            const long long cx = cvRound( stats.centroid.x );
+            const long long cy = cvRound( stats.centroid.y );
+            stats.mu20 = static_cast<double>( sumxx - 2 * cx * sumx + num * cx * cx ) / num;
+            stats.mu02 = static_cast<double>( sumyy - 2 * cy * sumy + num * cy * cy ) / num;
+            stats.mu11 = static_cast<double>( sumxy - cx * sumy - cy * sumx + num * cx * cy ) / num;
+            if ( collectPixels ) {
+               stats.bitmap = cv::Mat::zeros( stats.boundingBox.size(), CV_8U );
+               for ( const cv::Point& pixel: stats.pixels ) {
+                  stats.bitmap.at<unsigned char>( pixel.y - miny, pixel.x - minx ) = 1;
+               }
+            }
+         } else {
+            stats.mu20 = stats.mu02 = stats.mu11 = stats.centroid.x; // NaN, like the empty averages
+         }
+         return stats;
+      }
+
+      double calculateSignOfAngle( const BlobStats& blob, const cv::Point2d& centroid, double angle ) {
+         PROFILE_SCOPE( "mirror tests" );
+         int besti = 0;
+         long bestintersect = 0;
+         for ( int i = 0; i <= 1; ++i ) {
+            long intersect = 0;
+            for ( int j = 0; j < 4; ++j ) {
+               cv::Point2d dir ( cos( static_cast<double>( i* 2.0 - 1.0 ) * angle + PI / 2. * j), sin( static_cast<double>( i* 2.0 - 1.0 ) * angle + PI / 2. * j) );
+               intersect +=  calculateMirrorIntersect( blob, centroid, dir );
+            }
+            if ( intersect > bestintersect ) {
+               bestintersect = intersect;
+               besti = i;
+            }
+         }
+         return static_cast<double>(besti) * 2. - 1.;
+      }
+
+      double calculateJ( const BlobStats& blob, const cv::Point2d& centroid, double angle, double signOfAngle ) {
+         PROFILE_SCOPE( "extent tests" );
+         double maxLen = 0.;
+         int maxJ = 0;
+         for ( int j = 0; j < 2; ++j ) {
+            cv::Point2d dir ( cos( signOfAngle * angle + PI / 2. * j), sin( signOfAngle * angle + PI / 2. * j ) );
+            const double len = calculateLen( blob, centroid, dir );
+            if ( len > maxLen ) {
+               maxLen = len;
+               maxJ = j;
+            }
+         }
+         return maxJ;
+      }
+
+      double estimateKWithHelper( const cv::Point2d& helper, double angle, double signOfAngle, double jOfAngle ) {
+         cv::Point2d dir ( cos( signOfAngle * angle + PI / 2. * jOfAngle), sin( signOfAngle * angle + PI / 2. * jOfAngle ) );
+         if ( dir.x * helper.x + dir.y * helper.y > 0 ) {
+            return 1.0;
+         }
+         return 0.0;
+      }
+
+      // The interpolated rows have no shift, the row after them has the shift of all of them
+      void writeRow( const TrajectoryRow& row ) {
+         if ( !pWriter_ ) {
+            return;
+         }
+         const int gap = row.frame - previousRow_.frame;
+         if ( hasPreviousRow_ && gap <= stride_ * framesPerShift_ ) {
+            double turn = row.angle - previousRow_.angle; // the shorter way
+            if ( turn > PI ) {
+               turn -= 2 * PI;
+            } else if ( turn < -PI ) {
+               turn += 2 * PI;
+            }
+            for ( int i = 1; i < gap; ++i ) {
+               const double t = static_cast<double>( i ) / gap;
+               pWriter_->write( TrajectoryRow{ previousRow_.x + t * ( row.x - previousRow_.x ), previousRow_.y + t * ( row.y - previousRow_.y ),
+                                               correctInterval( previousRow_.angle + t * turn ), previousRow_.valid && row.valid,
+                                               previousRow_.frame + i, 0.f, 0.f } );
+            }
+         }
+         pWriter_->write( row );
+         previousRow_ = row;
+         hasPreviousRow_ = true;
+      }
+
+      double correctInterval( double angle ) {
+         while ( angle < 0.0 ) {
+            angle += 2 * PI;
+         }
+         while ( angle > 2 * PI ) {
+            angle -= 2 * PI;
+         }
+         return angle;
+      }
+
+      long calculateMirrorIntersect( const BlobStats& blob, const cv::Point2d& centroid, const cv::Point2d& mir ) {
+         long intersect = 0;
+
+         for ( const cv::Point& pixel: blob.pixels ) {
+            const double dirx = pixel.x - centroid.x;
+            const double diry = pixel.y - centroid.y;
+            const double dot = dirx * mir.x + diry * mir.y;
+
+            // truncated, not rounded, as before
+            const int pointx = 2.0 * dot * mir.x - dirx + centroid.x;
+            const int pointy = 2.0 * dot * mir.y - diry + centroid.y;
+            intersect += blob.contains( pointx, pointy );
+         }
+
+         return intersect;
+      }
+
+      long calculateLen( const BlobStats& blob, const cv::Point2d& centroid, cv::Point2d mir ) {
+         double len = 0;
+
+         for ( const cv::Point& pixel: blob.pixels ) {
+            const double dot = ( pixel.x - centroid.x ) * mir.x + ( pixel.y - centroid.y ) * mir.y;
+            len = std::max( len, fabs( dot ) );
+         }
+
+         return len;
+      }
+
+      // The distribution is a lookup table of 256 entries, 255 for the values seen under the mask.
+      // The table is reused, but only the current frame counts.
+      void createColorDistribution( const cv::Mat& img, const cv::Mat& mask, unsigned char maskValue, cv::Mat& distribution ) const {
+         PROFILE_SCOPE( "color distribution" );
+         if ( distribution.empty() ) {
+            distribution.create( 1, 256, CV_8U );
+         }
+         distribution.setTo( cv::Scalar( 0 ) );
+         unsigned char* table = distribution.ptr<unsigned char>( 0 );
+         for(int y=0;y<img.rows;y++) {
+            const unsigned char* imgRow = img.ptr<unsigned char>( y );
+            const unsigned char* maskRow = mask.ptr<unsigned char>( y );
+            for(int x=0;x<img.cols;x++) {
+               if ( maskRow[x] == maskValue ) {
+                  table[ imgRow[x] ] = 255;
+               }
+            }
+         }
+      }
+
+      // Every value of the table comes from the image, so any nonzero entry means a nonempty mask
+      bool createColorMask( cv::Mat& mask, const cv::Mat& img, const cv::Mat& background ) const {
+         PROFILE_SCOPE( "color mask" );
+         cv::LUT( img, background, mask );
+         return cv::countNonZero( background ) > 0;
+      }
+
+      const std::vector<cv::Vec2f>& trajectory_;
+      const Panorama& background_;
+      const cv::Mat& sbpResult_;
+      int roiMargin_ = 0;
+      cv::Rect lastBlobRect_;
+      cv::Mat backgroundHues_;
+      long numOfRoiFallbacks_ = 0;
+      cv::Point2d centroidDistorted_;
+      cv::Point2d centroid_;
+      cv::Point2d angleVect_;
+      cv::Point origin_;
+      int ax_;
+      int ay_;
+      double averageArea_ = 0.;
+      long areaSamples_ = 0;
+      int index_ = 0;
+      int numOfForgottenShifts_ = 0;
+      int stride_ = 1;
+      int framesPerShift_ = 1;
+      cv::Vec2f frameShift_ = cv::Vec2f( 0, 0 ); // since the previous row
+      TrajectoryRow previousRow_ = TrajectoryRow();
+      bool hasPreviousRow_ = false;
+      long validAreaCounter_ = 0;
+      double lastAngle_ = 0.;
+      bool hasLastAngle_ = false;
+      std::deque<cv::Point2d> places_; // only the last ones, the motion vector needs 11 of them
+      TrajectoryWriter* pWriter_ = nullptr;
+
+      static constexpr double PI = 3.141592653589793;
+      static const size_t MAX_NUM_OF_PLACES = 11;
+};
+
+#endif /* CARPROCESSOR_H */
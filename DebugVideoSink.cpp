@@ -0,0 +1,82 @@
+#include <iostream>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "DebugVideoSink.h"
+
+DebugVideoSink::DebugVideoSink( const std::string& prefix, int samplingRate, double fps, size_t maxQueuedFrames )
+ : prefix_( prefix ), samplingRate_( samplingRate > 0 ? samplingRate : 1 ), fps_( fps ), maxQueuedFrames_( maxQueuedFrames ),
+   thread_( &DebugVideoSink::run, this )
+{}
+
+DebugVideoSink::~DebugVideoSink() {
+   {
+      std::lock_guard<std::mutex> lock( mutex_ );
+      stopping_ = true;
+   }
+   condition_.notify_one();
+   thread_.join();
+   if ( droppedFrames_ ) {
+      std::cerr << "Debug video: " << droppedFrames_ << " frames were dropped" << std::endl;
+   }
+}
+
+void
+DebugVideoSink::push( const std::string& stream, const cv::Mat& image ) {
+   {
+      std::lock_guard<std::mutex> lock( mutex_ );
+      if ( queue_.size() >= maxQueuedFrames_ ) {
+         ++droppedFrames_;
+         return;
+      }
+      queue_.push_back( std::make_pair( stream, image ) );
+   }
+   condition_.notify_one();
+}
+
+long
+DebugVideoSink::getNumOfDroppedFrames() const {
+   std::lock_guard<std::mutex> lock( mutex_ );
+   return droppedFrames_;
+}
+
+void
+DebugVideoSink::run() {
+   for (;;) {
+      std::pair<std::string, cv::Mat> elem;
+      {
+         std::unique_lock<std::mutex> lock( mutex_ );
+         condition_.wait( lock, [this] { return stopping_ || !queue_.empty(); } );
+         if ( queue_.empty() ) {
+            break; // stopping, and everything is flushed
+         }
+         elem = queue_.front();
+         queue_.pop_front();
+      }
+      write( elem.first, elem.second );
+   }
+   for ( auto& writer: writers_ ) {
+      writer.second.release();
+   }
+}
+
+void
+DebugVideoSink::write( const std::string& stream, const cv::Mat& image ) {
+   // the masks are single channel, but not every codec likes grayscale input
+   cv::Mat colorImage = image;
+   if ( image.channels() == 1 ) {
+      cv::cvtColor( image, colorImage, CV_GRAY2BGR );
+   }
+
+   auto it = writers_.find( stream );
+   if ( it == writers_.end() ) {
+      const std::string filename = prefix_ + "_" + stream + ".avi";
+      it = writers_.insert( std::make_pair( stream, cv::VideoWriter() ) ).first;
+      if ( !it->second.open( filename, CV_FOURCC('M','J','P','G'), fps_, colorImage.size(), true ) ) {
+         std::cerr << "Failed to open debug video " << filename << std::endl;
+      }
+   }
+   if ( it->second.isOpened() ) {
+      it->second.write( colorImage );
+   }
+}
@@ -0,0 +1,49 @@
+#ifndef DEBUGVIDEOSINK_H
+#define DEBUGVIDEOSINK_H
+
+#include <string>
+#include <map>
+#include <deque>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "opencv2/highgui/highgui.hpp"
+
+// Writes the debug overlays of the processors into video files on a background thread,
+// so the processing loop never waits for encoding. Every stream goes to <prefix>_<stream>.avi.
+class DebugVideoSink {
+public:
+   DebugVideoSink( const std::string& prefix, int samplingRate = 1, double fps = 25., size_t maxQueuedFrames = 64 );
+   ~DebugVideoSink();
+
+   // Only every samplingRate-th frame is written, the processors should not even draw the others
+   bool isSampled( long frameIndex ) const { return frameIndex % samplingRate_ == 0; }
+
+   // The image is not copied, the caller must not modify it after pushing. If the writer thread
+   // can't keep up, the frame is dropped instead of blocking the caller.
+   void push( const std::string& stream, const cv::Mat& image );
+
+   long getNumOfDroppedFrames() const;
+
+private:
+   void run();
+   void write( const std::string& stream, const cv::Mat& image );
+
+   const std::string prefix_;
+   const int samplingRate_;
+   const double fps_;
+   const size_t maxQueuedFrames_;
+
+   std::map<std::string, cv::VideoWriter> writers_;
+   std::deque< std::pair<std::string, cv::Mat> > queue_;
+   long droppedFrames_ = 0;
+   bool stopping_ = false;
+
+   mutable std::mutex mutex_;
+   std::condition_variable condition_;
+   std::thread thread_;
+};
+
+#endif /* DEBUGVIDEOSINK_H */
@@ -0,0 +1,149 @@
+#include <cstdlib>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "DecimatingFrameSource.h"
+
+namespace {
+   const int MAX_UPSCALE = 4;
+   const double MIN_BLOCK_EDGE = 2.; // mean difference of neighbours on the block borders, in gray levels
+
+   // Mean absolute difference of the horizontal and vertical neighbours, separately for the pairs
+   // crossing a border of the factor x factor blocks and for the pairs inside the blocks
+   void measureBlocks( const cv::Mat& gray, int factor, double& border, double& inside ) {
+      long borderSum = 0, insideSum = 0;
+      long borderPairs = 0, insidePairs = 0;
+      for ( int y = 0; y < gray.rows; ++y ) {
+         const unsigned char* row = gray.ptr<unsigned char>( y );
+         const unsigned char* previousRow = y ? gray.ptr<unsigned char>( y - 1 ) : nullptr;
+         const bool rowOnBorder = y % factor == 0;
+         for ( int x = 0; x < gray.cols; ++x ) {
+            if ( x ) {
+               const int diff = abs( row[x] - row[x - 1] );
+               if ( x % factor == 0 ) {
+                  borderSum += diff;
+                  ++borderPairs;
+               } else {
+                  insideSum += diff;
+                  ++insidePairs;
+               }
+            }
+            if ( previousRow ) {
+               const int diff = abs( row[x] - previousRow[x] );
+               if ( rowOnBorder ) {
+                  borderSum += diff;
+                  ++borderPairs;
+               } else {
+                  insideSum += diff;
+                  ++insidePairs;
+               }
+            }
+         }
+      }
+      border = borderPairs ? static_cast<double>( borderSum ) / borderPairs : 0.;
+      inside = insidePairs ? static_cast<double>( insideSum ) / insidePairs : 0.;
+   }
+}
+
+DecimatingFrameSource::DecimatingFrameSource( FrameSource& source, int upscale, int downscale, size_t maxDetectionBytes )
+ : source_( source ), upscale_( upscale ), downscale_( downscale > 0 ? downscale : 1 ), maxDetectionBytes_( maxDetectionBytes )
+{}
+
+int
+DecimatingFrameSource::detectUpscale( const cv::Mat& frame ) {
+   cv::Mat gray;
+   if ( frame.channels() == 3 ) {
+      cv::cvtColor( frame, gray, CV_BGR2GRAY );
+   } else {
+      gray = frame;
+   }
+   bool flat = true;
+   bool divisible = false;
+   // the larger factors first, an upscale of 4 looks like an upscale of 2 as well
+   for ( int factor = MAX_UPSCALE; factor >= 2; --factor ) {
+      if ( gray.cols % factor || gray.rows % factor ) {
+         continue;
+      }
+      divisible = true;
+      double border = 0., inside = 0.;
+      measureBlocks( gray, factor, border, inside );
+      if ( border < MIN_BLOCK_EDGE ) {
+         continue; // nothing to see at this factor
+      }
+      flat = false;
+      // compression noise is allowed inside the blocks, but the edges have to be much stronger
+      if ( inside * 8. < border ) {
+         return factor;
+      }
+   }
+   return flat && divisible ? 0 : 1;
+}
+
+void
+DecimatingFrameSource::decimate( const cv::Mat& src, cv::Mat& dst ) const {
+   cv::resize( src, dst, cv::Size( src.cols / factor_, src.rows / factor_ ), 0, 0, cv::INTER_NEAREST );
+}
+
+void
+DecimatingFrameSource::detect() {
+   cv::Mat frame;
+   size_t bytes = 0;
+   while ( source_.read( frame ) ) {
+      pending_.push_back( frame.clone() ); // the source may reuse its buffer
+      bytes += frame.total() * frame.elemSize();
+      const int upscale = detectUpscale( frame );
+      if ( upscale > 0 ) {
+         factor_ = upscale * downscale_;
+         detected_ = true;
+         break;
+      }
+      if ( bytes + frame.total() * frame.elemSize() > maxDetectionBytes_ ) {
+         break;
+      }
+   }
+   if ( !detected_ ) {
+      factor_ = downscale_;
+   }
+   if ( factor_ > 1 ) {
+      for ( cv::Mat& elem: pending_ ) {
+         cv::Mat decimated;
+         decimate( elem, decimated );
+         elem = decimated;
+      }
+   }
+}
+
+bool
+DecimatingFrameSource::read( cv::Mat& frame ) {
+   if ( !factor_ ) {
+      if ( upscale_ > 0 ) {
+         factor_ = upscale_ * downscale_;
+      } else {
+         detect();
+      }
+   }
+
+   if ( !pending_.empty() ) {
+      frame = pending_.front();
+      pending_.pop_front();
+      return true;
+   }
+   if ( factor_ == 1 ) {
+      return source_.read( frame );
+   }
+   if ( !source_.read( decoded_ ) ) {
+      frame.release();
+      return false;
+   }
+   decimate( decoded_, frame );
+   return true;
+}
+
+bool
+DecimatingFrameSource::skip() {
+   if ( !pending_.empty() ) {
+      pending_.pop_front();
+      return true;
+   }
+   return source_.skip();
+}
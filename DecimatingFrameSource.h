@@ -0,0 +1,43 @@
+#ifndef DECIMATINGFRAMESOURCE_H
+#define DECIMATINGFRAMESOURCE_H
+
+#include <deque>
+
+#include "FrameSource.h"
+
+// Shrinks the frames of an upscaled capture back towards the resolution the game drew them in,
+// by nearest neighbour decimation, so every later pass works on fewer pixels. The factor is the
+// upscale of the capture times a further downscale. An upscale of 0 is detected from the first
+// frames showing enough details; the frames read for the detection are kept and given back in
+// order, at most maxDetectionBytes of them, decimated as soon as the factor is known. If none of
+// them decides, the capture is taken as not upscaled.
+//
+// getFactor() is valid after the first read().
+class DecimatingFrameSource : public FrameSource {
+public:
+   DecimatingFrameSource( FrameSource& source, int upscale, int downscale = 1, size_t maxDetectionBytes = 64 * 1024 * 1024 );
+   virtual bool read( cv::Mat& frame ) override;
+   virtual bool skip() override;
+
+   int getFactor() const { return factor_; }
+   bool isDetected() const { return detected_; }
+
+   // The integer upscale of a frame, 1 if it isn't upscaled or its size has no factor to test,
+   // 0 if the frame is too flat to tell
+   static int detectUpscale( const cv::Mat& frame );
+
+private:
+   void detect();
+   void decimate( const cv::Mat& src, cv::Mat& dst ) const;
+
+   FrameSource& source_;
+   const int upscale_;
+   const int downscale_;
+   const size_t maxDetectionBytes_;
+   int factor_ = 0;
+   bool detected_ = false;
+   cv::Mat decoded_;
+   std::deque<cv::Mat> pending_; // already decimated once the factor is known
+};
+
+#endif /* DECIMATINGFRAMESOURCE_H */
@@ -0,0 +1,468 @@
+#ifndef DYNAMICBACKGROUNDPROCESSOR_H
+#define DYNAMICBACKGROUNDPROCESSOR_H
+
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "ImageProcessor.h"
+#include "MismatchKernel.h"
+#include "Panorama.h"
+#include "Profiler.h"
+
+const unsigned char MAX_NUM_OF_SAMPLES_IN_AVERAGE_IMAGE = 250;
+const bool MERGE_PREVIOUS_DIFF = false;
+const short int MAX_STEP = 10;
+
+// How DynamicBackgroundProcessor finds the shift between two frames. Only brute force gives the
+// foreground mask of the original scan: the strips outside the overlap of the winner keep the diffs
+// of the candidates that improved on the best one before it. The other engines see only a few
+// candidates, so they leave those strips empty, and the strips count as foreground. The panorama
+// gets fewer samples near the frame borders than with brute force, even if the shifts are the same.
+enum class ShiftEngine {
+   BRUTE_FORCE, // testing every shift in the +-maxstep window at full resolution
+   PYRAMID,     // estimating on downsampled images, refining only a small neighbourhood on each finer level
+   PHASE,       // FFT phase correlation, falling back to brute force if the correlation peak is weak
+   PREDICTIVE   // small window around the extrapolated previous shift, the full window only if the match is poor
+};
+
+struct ShiftSearchParameters {
+   ShiftEngine engine = ShiftEngine::BRUTE_FORCE;
+   int pyramidLevels = 2;
+   int pyramidRefineRadius = 2;
+   double phaseMinResponse = 0.1;
+   int predictiveRadius = 2;
+   double predictiveMaxResidual = 0.05; // ratio of mismatching pixels in the overlap
+};
+
+// The shift of the background between the frames and the panorama of the track
+class DynamicBackgroundProcessor : public ImageProcessor {
+   public:
+      DynamicBackgroundProcessor( std::vector<cv::Vec2f>& trajectory,
+                                  const cv::Mat* pStaticBackground = 0,
+                                  unsigned char maxNumOfSamplesInAverageImage = MAX_NUM_OF_SAMPLES_IN_AVERAGE_IMAGE, short int maxstep = MAX_STEP, bool mergePreviousDiff = MERGE_PREVIOUS_DIFF,
+                                  const ShiftSearchParameters& shiftSearch = ShiftSearchParameters() )
+       : trajectory_( trajectory ), pStaticBackground_( pStaticBackground ), pPreviousMask_( nullptr ),
+         maxstep_( maxstep ), mergePreviousDiff_( mergePreviousDiff ),
+         shiftSearch_( shiftSearch ), segmentedBackground_( maxNumOfSamplesInAverageImage )
+      {
+      }
+
+      virtual bool process( const cv::Mat& frame, bool dropped ) override {
+         if ( numOfFramesToSkip_ > 0 && !frame.empty() ) {
+            // restored from a checkpoint, only the before frame is needed
+            --numOfFramesToSkip_;
+            return ImageProcessor::process( frame, dropped );
+         }
+         short int dx = 0;
+         short int dy = 0;
+         if ( !dropped ) {
+            if (frame.empty()) {
+                writeBackground();
+                return false;
+            }
+            cv::Mat diff = frame.clone();
+        
+            cv::Mat foregroundMask = calculateShift(getBeforeFrame(), frame, dx, dy);
+            cv::Mat totalMask( foregroundMask.size(), foregroundMask.type() ); 
+            foregroundMask.copyTo( totalMask );
+
+            if ( mergePreviousDiff_ ) {
+               // Managing previous mask and merging it to total
+               if ( pPreviousMask_ ) {
+                  cv::bitwise_and( *pPreviousMask_, totalMask, totalMask );
+               } else {
+                  pPreviousMask_ = new cv::Mat( totalMask.size(), totalMask.type() );
+               }
+               foregroundMask.copyTo( *pPreviousMask_ );
+            }
+
+            cv::erode( totalMask, totalMask, cv::getStructuringElement( cv::MORPH_RECT, cv::Size(9,9), cv::Point(5,5) ));
+            addToBackground( getBeforeFrame(), totalMask, ax_, ay_ );
+        
+            ax_ += dx;
+            ay_ += dy;
+        
+            if ( isDebugEnabled() ) {
+               cv::Mat beforeFrame_Masked(getBeforeFrame().size(), getBeforeFrame().type(), cv::Scalar(0,255,0));
+               getBeforeFrame().copyTo( beforeFrame_Masked, totalMask );
+               showDebug( "binary", beforeFrame_Masked );
+            }
+         }
+         trajectory_.push_back( cv::Vec2f( dx, dy ) );
+         if ( checkpointInterval_ > 0 && trajectory_.size() % checkpointInterval_ == 0 ) {
+            checkpoint_( trajectory_, segmentedBackground_ );
+         }
+
+         ImageProcessor::process( frame, dropped );
+        
+         return true;
+      }
+      virtual std::string getTitle() const override { return "Processing"; }
+
+      // The populated part of the panorama
+      const cv::Mat getResult() const {
+         return segmentedBackground_.getResult();
+      }
+
+      // The background image is written here at the end of the stream, empty: not written
+      void setBackgroundPath( const std::string& path ) { backgroundPath_ = path; }
+      // On decimated frames the image is enlarged back to the pixels of the video
+      void setBackgroundScale( int scale ) { backgroundScale_ = scale; }
+      void writeBackground() const {
+         if ( backgroundPath_.empty() ) {
+            return;
+         }
+         if ( backgroundScale_ > 1 ) {
+            cv::Mat result;
+            cv::resize( getResult(), result, cv::Size(), backgroundScale_, backgroundScale_, cv::INTER_NEAREST );
+            cv::imwrite( backgroundPath_, result );
+         } else {
+            cv::imwrite( backgroundPath_, getResult() );
+         }
+      }
+
+      // The panorama in the coordinates of the first frame
+      const Panorama& getPanorama() const { return segmentedBackground_; }
+
+      // Continuing from a stored state: load( trajectory, panorama ) has to fill both with the
+      // results of the first frames, those frames are only passed through after that
+      bool restore( const std::function<bool( std::vector<cv::Vec2f>&, Panorama& )>& load ) {
+         std::vector<cv::Vec2f> trajectory;
+         if ( !load( trajectory, segmentedBackground_ ) ) {
+            return false;
+         }
+         trajectory_ = trajectory;
+         ax_ = ay_ = 0;
+         for ( const auto& elem: trajectory_ ) {
+            ax_ += elem[0];
+            ay_ += elem[1];
+         }
+         numOfFramesToSkip_ = trajectory_.size();
+         return true;
+      }
+
+      // The callback gets the state after every interval frames
+      void setCheckpoint( size_t interval, const std::function<void( const std::vector<cv::Vec2f>&, const Panorama& )>& callback ) {
+         checkpointInterval_ = interval;
+         checkpoint_ = callback;
+      }
+
+      // Number of frames where the phase correlation peak was too weak to trust or the prediction failed
+      long getNumOfShiftFallbacks() const { return numOfShiftFallbacks_; }
+      // Candidates scored over the frames the shift was calculated on, without the dropped and restored frames
+      long getNumOfShiftCandidates() const { return numOfShiftCandidates_; }
+      long getNumOfShiftCalculations() const { return numOfShiftCalculations_; }
+
+   private:
+      // the kernels are measured one by one in processor_bench
+      friend class ProcessorBenchmark;
+
+      // Roboust solution for calculating the shift between two frames after each other
+      cv::Mat calculateShift( const cv::Mat& before, const cv::Mat& after, short int& rx, short int& ry ) {
+         PROFILE_SCOPE( "calculateShift" );
+         ++numOfShiftCalculations_;
+         // Creating the diff image, converting it to binary, then dilate a bit -> filtering out areas with exactly the same pixels
+         cv::Mat binaryMaskMat(before.size(), CV_8U);
+         if ( pStaticBackground_ ) {
+            pStaticBackground_->copyTo( binaryMaskMat );
+            cv::bitwise_not( binaryMaskMat, binaryMaskMat );
+         } else {
+            cv::Mat diff(before.size(), before.type());
+            cv::absdiff(before, after, diff);
+            cv::Mat grayscaleMat( before.size(), CV_8U);
+            cv::cvtColor( diff, grayscaleMat, CV_BGR2GRAY );
+            cv::threshold(grayscaleMat, binaryMaskMat, 1, 255, cv::THRESH_BINARY);
+            cv::dilate( binaryMaskMat, binaryMaskMat, cv::getStructuringElement( cv::MORPH_RECT, cv::Size(7,7), cv::Point(3,3) ));
+         }
+
+         // Do the filter both on the before and on the after image 
+         cv::Mat beforeGrayscale( before.size(), CV_8U );
+         cv::cvtColor( before, beforeGrayscale, CV_BGR2GRAY );
+         cv::Mat beforeGrayscaleMasked( before.size(), CV_8U, cvScalar(0.) );
+         beforeGrayscale.copyTo( beforeGrayscaleMasked, binaryMaskMat );
+
+         cv::Mat afterGrayscale( after.size(), CV_8U );
+         cv::cvtColor( after, afterGrayscale, CV_BGR2GRAY );
+         cv::Mat afterGrayscaleMasked( after.size(), CV_8U, cvScalar(0.) );
+         afterGrayscale.copyTo( afterGrayscaleMasked, binaryMaskMat );
+
+         // The claim is that if we apply the correct shift, then the diff image will contain a very few points
+         int bestix = 0;
+         int bestiy = 0;
+         bool found = false;
+         std::vector<cv::Point> improvements;
+         if ( shiftSearch_.engine == ShiftEngine::PYRAMID ) {
+            found = searchShiftWithPyramid( beforeGrayscaleMasked, afterGrayscaleMasked, bestix, bestiy );
+         } else if ( shiftSearch_.engine == ShiftEngine::PHASE ) {
+            found = searchShiftWithPhaseCorrelation( beforeGrayscaleMasked, afterGrayscaleMasked, binaryMaskMat, bestix, bestiy );
+         } else if ( shiftSearch_.engine == ShiftEngine::PREDICTIVE ) {
+            found = searchShiftAroundPrediction( beforeGrayscaleMasked, afterGrayscaleMasked, bestix, bestiy );
+         } else {
+            long minimum = afterGrayscale.cols * afterGrayscale.rows;
+            found = searchShiftExhaustively( beforeGrayscaleMasked, afterGrayscaleMasked, cv::Rect( -maxstep_, -maxstep_, 2 * maxstep_ + 1, 2 * maxstep_ + 1 ), minimum, bestix, bestiy,
+                                             &improvements );
+         }
+         if ( found && improvements.empty() ) {
+            improvements.push_back( cv::Point( bestix, bestiy ) );
+         }
+
+         cv::Mat diffStored(beforeGrayscaleMasked.size(), beforeGrayscaleMasked.type(), cvScalar(0.)); // debug
+         if ( found ) {
+            rx = -bestix; // sorry, I wrote the entire logic in the opposite way and I don't feel like to rewrite everything
+            ry = -bestiy;
+            // as the original scan did: every improving candidate writes its diff, so the strips
+            // outside the overlap of the winner keep the diffs of the earlier ones. Only brute force
+            // knows them, the other engines write the diff of the winner only, see ShiftEngine
+            for ( const cv::Point& elem: improvements ) {
+               cv::Rect beforeRect, afterRect;
+               getShiftedRects( afterGrayscaleMasked.size(), elem.x, elem.y, beforeRect, afterRect );
+               cv::absdiff( beforeGrayscaleMasked( beforeRect ), afterGrayscaleMasked( afterRect ), diffStored( beforeRect ) );
+            }
+         }
+
+         cv::Mat diffStoredBW( after.size(), CV_8U, cvScalar(0.) );
+         if ( rx == 0 && ry == 0 ) {
+            return diffStoredBW;
+         }
+
+         cv::threshold( diffStored, diffStoredBW, 0, 255, cv::THRESH_BINARY ); // threshold: 0, everything that was not in the last round
+         cv::bitwise_not( diffStoredBW, diffStoredBW );
+         cv::bitwise_and( binaryMaskMat, diffStoredBW, diffStoredBW );
+
+         return diffStoredBW;
+      }
+
+      // The overlapping areas of the before and the after image when the after image is shifted by (ix, iy)
+      static void getShiftedRects( const cv::Size& size, int ix, int iy, cv::Rect& beforeRect, cv::Rect& afterRect ) {
+         // had no better idea
+         int px = ix > 0 ?  ix : 0;
+         int nx = ix < 0 ? -ix : 0;
+         int py = iy > 0 ?  iy : 0;
+         int ny = iy < 0 ? -iy : 0;
+         int sizex = size.width  - ( px > nx ? px : nx );
+         int sizey = size.height - ( py > ny ? py : ny );
+         afterRect  = cv::Rect( px, py, sizex, sizey );
+         beforeRect = cv::Rect( nx, ny, sizex, sizey );
+      }
+
+      // Number of pixels differing between the overlapping areas, working on the rows in place.
+      // Above the limit it is only guaranteed to be more than the limit.
+      static long countShiftedMismatches( const cv::Mat& before, const cv::Mat& after, int ix, int iy, long limit = LONG_MAX ) {
+         cv::Rect beforeRect, afterRect;
+         getShiftedRects( after.size(), ix, iy, beforeRect, afterRect );
+         return countMismatches( before.ptr<unsigned char>( beforeRect.y ) + beforeRect.x, before.step,
+                                 after.ptr<unsigned char>( afterRect.y ) + afterRect.x, after.step,
+                                 afterRect.width, afterRect.height, limit );
+      }
+
+      // Scores a range of the candidates of a window, candidate i is ( x + i / height, y + i % height ).
+      // Counting stops as soon as a candidate gets worse than the best one seen by any thread; such a
+      // candidate can't win, and a candidate equal to the final minimum is never cut.
+      class ShiftCandidateScorer : public cv::ParallelLoopBody {
+         public:
+            ShiftCandidateScorer( const cv::Mat& before, const cv::Mat& after, const cv::Rect& window, std::vector<long>& scores, std::vector<long>& limits,
+                                  std::atomic<long>& bound )
+             : before_( before ), after_( after ), window_( window ), scores_( scores ), limits_( limits ), bound_( bound ) {}
+
+            virtual void operator()( const cv::Range& range ) const override {
+               for ( int i = range.start; i < range.end; ++i ) {
+                  long bound = bound_.load( std::memory_order_relaxed );
+                  const long score = countShiftedMismatches( before_, after_, window_.x + i / window_.height, window_.y + i % window_.height, bound );
+                  scores_[i] = score;
+                  limits_[i] = bound;
+                  while ( score < bound && !bound_.compare_exchange_weak( bound, score, std::memory_order_relaxed ) ) {
+                  }
+               }
+            }
+
+         private:
+            const cv::Mat& before_;
+            const cv::Mat& after_;
+            const cv::Rect window_;
+            std::vector<long>& scores_;
+            std::vector<long>& limits_; // a score above its limit is not exact
+            std::atomic<long>& bound_;
+      };
+
+      // Testing every shift of the window, keeps the first one with the least mismatching pixels.
+      // Returns false if none of them was better than the minimum passed in.
+      // The candidates are scored in parallel, but the winner is picked in the scanning order, so
+      // the result doesn't depend on the number of threads.
+      // pImprovements gets every candidate which was better than all the ones before it in the
+      // scanning order, the winner is the last one. A candidate cut by a bound found on another
+      // thread is counted again if it may be one of them.
+      bool searchShiftExhaustively( const cv::Mat& before, const cv::Mat& after, const cv::Rect& window, long& minimum, int& bestix, int& bestiy,
+                                    std::vector<cv::Point>* pImprovements = nullptr ) {
+         if ( window.width <= 0 || window.height <= 0 ) {
+            return false;
+         }
+         numOfShiftCandidates_ += window.area();
+         std::vector<long> scores( window.area() );
+         std::vector<long> limits( window.area() );
+         std::atomic<long> bound( minimum );
+         cv::parallel_for_( cv::Range( 0, window.area() ), ShiftCandidateScorer( before, after, window, scores, limits, bound ) );
+
+         bool found = false;
+         for ( int i = 0; i < window.area(); ++i ) {
+            if ( pImprovements && scores[i] > limits[i] && limits[i] < minimum - 1 ) {
+               scores[i] = countShiftedMismatches( before, after, window.x + i / window.height, window.y + i % window.height, minimum - 1 );
+            }
+            if ( scores[i] < minimum ) {
+               minimum = scores[i];
+               bestix = window.x + i / window.height;
+               bestiy = window.y + i % window.height;
+               found = true;
+               if ( pImprovements ) {
+                  pImprovements->push_back( cv::Point( bestix, bestiy ) );
+               }
+            }
+         }
+         return found;
+      }
+
+      // Coarse-to-fine search: on the downsampled levels the images never match exactly, so the
+      // candidates are compared by mean absolute difference there. The full resolution level uses
+      // the same metric and the same scanning order as the exhaustive search, so the shift is
+      // the same whenever the exhaustive optimum is in the refined neighbourhood. The mask is not,
+      // its strips outside the overlap of the winner differ, see ShiftEngine.
+      bool searchShiftWithPyramid( const cv::Mat& before, const cv::Mat& after, int& bestix, int& bestiy ) {
+         const int levels = shiftSearch_.pyramidLevels;
+         const int refine = shiftSearch_.pyramidRefineRadius;
+
+         std::vector<cv::Mat> beforeLevels( 1, before );
+         std::vector<cv::Mat> afterLevels( 1, after );
+         for ( int level = 1; level <= levels; ++level ) {
+            if ( beforeLevels.back().cols < 32 || beforeLevels.back().rows < 32 ) {
+               break; // no reason to go further, the overlaps would be too tiny
+            }
+            cv::Mat beforeDown, afterDown;
+            cv::pyrDown( beforeLevels.back(), beforeDown );
+            cv::pyrDown( afterLevels.back(), afterDown );
+            beforeLevels.push_back( beforeDown );
+            afterLevels.push_back( afterDown );
+         }
+
+         const int top = beforeLevels.size() - 1;
+         const int topStep = ( maxstep_ + ( 1 << top ) - 1 ) >> top;
+         cv::Rect window( -topStep, -topStep, 2 * topStep + 1, 2 * topStep + 1 );
+         int cx = 0;
+         int cy = 0;
+         for ( int level = top; level >= 1; --level ) {
+            double minimum = 256.;
+            for ( int ix = window.x; ix < window.x + window.width; ++ix ) {
+               for ( int iy = window.y; iy < window.y + window.height; ++iy ) {
+                  cv::Rect beforeRect, afterRect;
+                  getShiftedRects( afterLevels[level].size(), ix, iy, beforeRect, afterRect );
+                  const double meanDiff = cv::norm( beforeLevels[level]( beforeRect ), afterLevels[level]( afterRect ), cv::NORM_L1 ) / afterRect.area();
+                  if ( meanDiff < minimum ) {
+                     minimum = meanDiff;
+                     cx = ix;
+                     cy = iy;
+                  }
+               }
+            }
+            window = cv::Rect( 2 * cx - refine, 2 * cy - refine, 2 * refine + 1, 2 * refine + 1 );
+         }
+
+         // the refined window can't leave the +-maxstep window of the exhaustive search
+         window &= cv::Rect( -maxstep_, -maxstep_, 2 * maxstep_ + 1, 2 * maxstep_ + 1 );
+         long minimum = after.cols * after.rows;
+         return searchShiftExhaustively( before, after, window, minimum, bestix, bestiy );
+      }
+
+      // Phase correlation finds the shift in O(N log N) whatever maxstep is. The masked out areas are
+      // filled with the mean instead of black, otherwise their static edges would vote for zero shift.
+      // The peak is only refined by the exact metric in its +-1 neighbourhood, if it is too weak,
+      // the exhaustive search decides.
+      bool searchShiftWithPhaseCorrelation( const cv::Mat& before, const cv::Mat& after, const cv::Mat& mask, int& bestix, int& bestiy ) {
+         cv::Mat beforeFloat, afterFloat;
+         before.convertTo( beforeFloat, CV_32F );
+         after.convertTo( afterFloat, CV_32F );
+         cv::Mat invertedMask;
+         cv::bitwise_not( mask, invertedMask );
+         beforeFloat.setTo( cv::mean( before, mask ), invertedMask );
+         afterFloat.setTo( cv::mean( after, mask ), invertedMask );
+
+         if ( hanningWindow_.size() != before.size() ) {
+            cv::createHanningWindow( hanningWindow_, before.size(), CV_32F );
+         }
+         double response = 0.;
+         const cv::Point2d peak = cv::phaseCorrelate( beforeFloat, afterFloat, hanningWindow_, &response );
+
+         long minimum = after.cols * after.rows;
+         const cv::Rect fullWindow( -maxstep_, -maxstep_, 2 * maxstep_ + 1, 2 * maxstep_ + 1 );
+         if ( response < shiftSearch_.phaseMinResponse ) {
+            ++numOfShiftFallbacks_;
+            return searchShiftExhaustively( before, after, fullWindow, minimum, bestix, bestiy );
+         }
+         const int cx = cvRound( peak.x );
+         const int cy = cvRound( peak.y );
+         return searchShiftExhaustively( before, after, cv::Rect( cx - 1, cy - 1, 3, 3 ), minimum, bestix, bestiy );
+      }
+
+      // The camera scrolls smoothly, so the shift is extrapolated from the last two ones and only a
+      // small window around it is searched. If even the best candidate mismatches too much, the
+      // prediction was wrong, then the whole +-maxstep window is searched.
+      bool searchShiftAroundPrediction( const cv::Mat& before, const cv::Mat& after, int& bestix, int& bestiy ) {
+         int predictedx = 0;
+         int predictedy = 0;
+         const size_t n = trajectory_.size();
+         if ( n >= 2 ) {
+            predictedx = 2 * trajectory_[n - 1][0] - trajectory_[n - 2][0];
+            predictedy = 2 * trajectory_[n - 1][1] - trajectory_[n - 2][1];
+         } else if ( n == 1 ) {
+            predictedx = trajectory_[0][0];
+            predictedy = trajectory_[0][1];
+         }
+
+         // the trajectory is stored as ( rx, ry ), the candidates are ( -rx, -ry )
+         const int radius = shiftSearch_.predictiveRadius;
+         const cv::Rect fullWindow( -maxstep_, -maxstep_, 2 * maxstep_ + 1, 2 * maxstep_ + 1 );
+         const cv::Rect window = cv::Rect( -predictedx - radius, -predictedy - radius, 2 * radius + 1, 2 * radius + 1 ) & fullWindow;
+
+         long minimum = after.cols * after.rows;
+         if ( searchShiftExhaustively( before, after, window, minimum, bestix, bestiy ) ) {
+            const double overlap = static_cast<double>( after.cols - abs( bestix ) ) * ( after.rows - abs( bestiy ) );
+            if ( minimum <= shiftSearch_.predictiveMaxResidual * overlap ) {
+               return true;
+            }
+         }
+
+         ++numOfShiftFallbacks_;
+         minimum = after.cols * after.rows;
+         return searchShiftExhaustively( before, after, fullWindow, minimum, bestix, bestiy );
+      }
+
+      void addToBackground( const cv::Mat& img, const cv::Mat& mask, int posx, int posy ) {
+         PROFILE_SCOPE( "addToBackground" );
+         segmentedBackground_.add( img, mask, posx, posy );
+      }
+
+   private:
+      std::vector<cv::Vec2f>& trajectory_;
+      const cv::Mat* pStaticBackground_;
+      cv::Mat* pPreviousMask_;
+      short int maxstep_;
+      const bool mergePreviousDiff_;
+      const ShiftSearchParameters shiftSearch_;
+      cv::Mat hanningWindow_;
+      long numOfShiftFallbacks_ = 0;
+      long numOfShiftCandidates_ = 0;
+      long numOfShiftCalculations_ = 0;
+
+      Panorama segmentedBackground_;
+      std::string backgroundPath_ = "car_game_background.png";
+      int backgroundScale_ = 1;
+      size_t numOfFramesToSkip_ = 0;
+      size_t checkpointInterval_ = 0;
+      std::function<void( const std::vector<cv::Vec2f>&, const Panorama& )> checkpoint_;
+      int ax_ = 0;
+      int ay_ = 0;
+};
+
+#endif /* DYNAMICBACKGROUNDPROCESSOR_H */
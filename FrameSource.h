@@ -0,0 +1,60 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include "opencv2/highgui/highgui.hpp"
+
+// Anything the processing shell can pull frames from. Just like VideoCapture::read,
+// read() returns false and leaves an empty frame at the end of the stream.
+class FrameSource {
+public:
+   virtual ~FrameSource() {}
+   virtual bool read( cv::Mat& frame ) = 0;
+
+   // Goes over the next frame, sources which can should do it without decoding it
+   virtual bool skip() {
+      cv::Mat frame;
+      return read( frame );
+   }
+};
+
+class CaptureFrameSource : public FrameSource {
+public:
+   CaptureFrameSource( cv::VideoCapture& capture ) : capture_( capture ) {}
+   virtual bool read( cv::Mat& frame ) override {
+      if ( !capture_.read( frame ) ) {
+         frame.release();
+         return false;
+      }
+      return true;
+   }
+   virtual bool skip() override { return capture_.grab(); }
+
+private:
+   cv::VideoCapture& capture_;
+};
+
+// Every stride-th frame of the wrapped source, starting with the first one, the frames in between
+// are skipped
+class StridingFrameSource : public FrameSource {
+public:
+   StridingFrameSource( FrameSource& source, int stride ) : source_( source ), stride_( stride ) {}
+   virtual bool read( cv::Mat& frame ) override {
+      if ( started_ ) {
+         for ( int i = 1; i < stride_; ++i ) {
+            if ( !source_.skip() ) {
+               frame.release();
+               return false;
+            }
+         }
+      }
+      started_ = true;
+      return source_.read( frame );
+   }
+
+private:
+   FrameSource& source_;
+   const int stride_;
+   bool started_ = false;
+};
+
+#endif /* FRAMESOURCE_H */
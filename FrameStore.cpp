@@ -0,0 +1,156 @@
+#include <cassert>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "FrameStore.h"
+
+FrameStore::FrameStore( size_t memoryBudgetInBytes, const std::string& spillDirectory )
+ : memoryBudget_( memoryBudgetInBytes ), spillDirectory_( spillDirectory )
+{}
+
+FrameStore::~FrameStore() {
+   if ( spillMap_ ) {
+      munmap( spillMap_, spillBytes_ );
+   }
+   if ( spillFd_ >= 0 ) {
+      close( spillFd_ );
+   }
+}
+
+bool
+FrameStore::append( const cv::Mat& frame ) {
+   assert( !finalized_ );
+   if ( !numOfFrames_ ) {
+      rows_ = frame.rows;
+      cols_ = frame.cols;
+      type_ = frame.type();
+      frameBytes_ = frame.total() * frame.elemSize();
+   }
+   if ( frame.rows != rows_ || frame.cols != cols_ || frame.type() != type_ ) {
+      std::cerr << "Frame store: the size of the frames changed in the video" << std::endl;
+      return false;
+   }
+
+   // once we started to spill, everything goes to the disk, otherwise the order would be lost
+   if ( spillFd_ < 0 && ( memoryFrames_.size() + 1 ) * frameBytes_ <= memoryBudget_ ) {
+      memoryFrames_.push_back( std::vector<unsigned char>( frameBytes_ ) );
+      unsigned char* dst = memoryFrames_.back().data();
+      const size_t rowBytes = cols_ * frame.elemSize();
+      for ( int y = 0; y < rows_; ++y ) {
+         memcpy( dst + y * rowBytes, frame.ptr( y ), rowBytes );
+      }
+   } else if ( !spill( frame ) ) {
+      return false;
+   }
+   ++numOfFrames_;
+   return true;
+}
+
+bool
+FrameStore::spill( const cv::Mat& frame ) {
+   if ( spillFd_ < 0 ) {
+      std::string pattern = spillDirectory_ + "/car_game_frames_XXXXXX";
+      std::vector<char> path( pattern.begin(), pattern.end() );
+      path.push_back( '\0' );
+      spillFd_ = mkstemp( path.data() );
+      if ( spillFd_ < 0 ) {
+         std::cerr << "Frame store: failed to create spill file in " << spillDirectory_ << ": " << strerror( errno ) << std::endl;
+         return false;
+      }
+      unlink( path.data() ); // nobody else needs its name, it disappears with the descriptor
+   }
+
+   const size_t rowBytes = cols_ * frame.elemSize();
+   for ( int y = 0; y < rows_; ++y ) {
+      const unsigned char* src = frame.ptr( y );
+      size_t written = 0;
+      while ( written < rowBytes ) {
+         const ssize_t result = ::write( spillFd_, src + written, rowBytes - written );
+         if ( result < 0 ) {
+            if ( errno == EINTR ) {
+               continue;
+            }
+            std::cerr << "Frame store: failed to write spill file: " << strerror( errno ) << std::endl;
+            return false;
+         }
+         written += result;
+      }
+   }
+   spillBytes_ += frameBytes_;
+   return true;
+}
+
+bool
+FrameStore::finalize() {
+   if ( finalized_ ) {
+      return true;
+   }
+   if ( spillBytes_ ) {
+      void* map = mmap( nullptr, spillBytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE, spillFd_, 0 );
+      if ( map == MAP_FAILED ) {
+         std::cerr << "Frame store: failed to map spill file: " << strerror( errno ) << std::endl;
+         return false;
+      }
+      spillMap_ = static_cast<unsigned char*>( map );
+      madvise( spillMap_, spillBytes_, MADV_SEQUENTIAL );
+   }
+   finalized_ = true;
+   return true;
+}
+
+cv::Mat
+FrameStore::at( size_t index ) const {
+   assert( index < numOfFrames_ );
+   unsigned char* data = nullptr;
+   if ( index < memoryFrames_.size() ) {
+      data = const_cast<unsigned char*>( memoryFrames_[ index ].data() );
+   } else {
+      assert( finalized_ );
+      data = spillMap_ + ( index - memoryFrames_.size() ) * frameBytes_;
+   }
+   return cv::Mat( rows_, cols_, type_, data );
+}
+
+bool
+FrameStore::Recorder::read( cv::Mat& frame ) {
+   if ( !source_.read( frame ) ) {
+      return false;
+   }
+   if ( !failed_ && !store_.append( frame ) ) {
+      failed_ = true;
+   }
+   return true;
+}
+
+bool
+FrameStore::Recorder::finish() {
+   cv::Mat frame;
+   while ( !failed_ && read( frame ) ) {
+   }
+   return !failed_ && store_.finalize();
+}
+
+bool
+FrameStore::Reader::read( cv::Mat& frame ) {
+   if ( index_ >= store_.size() ) {
+      frame.release();
+      return false;
+   }
+   frame = store_.at( index_++ );
+   return true;
+}
+
+bool
+FrameStore::Reader::skip() {
+   if ( index_ >= store_.size() ) {
+      return false;
+   }
+   ++index_;
+   return true;
+}
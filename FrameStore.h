@@ -0,0 +1,73 @@
+#ifndef FRAMESTORE_H
+#define FRAMESTORE_H
+
+#include <string>
+#include <vector>
+
+#include "FrameSource.h"
+
+// Keeps every decoded frame of a video, so the passes after the first one don't have to decode
+// it again. Frames are kept in memory while they fit into the budget, the rest is spilled into an
+// (already unlinked) temporary file, which is memory mapped after recording.
+//
+// Usage: record the first pass through a Recorder, finish() it, then replay with Readers.
+class FrameStore {
+public:
+   FrameStore( size_t memoryBudgetInBytes, const std::string& spillDirectory = "/tmp" );
+   ~FrameStore();
+
+   bool append( const cv::Mat& frame );
+   bool finalize(); // has to be called before reading spilled frames
+
+   size_t size() const { return numOfFrames_; }
+   size_t getNumOfSpilledFrames() const { return numOfFrames_ - memoryFrames_.size(); }
+   cv::Mat at( size_t index ) const; // read-only view, no copy
+
+   // Passes the frames of the source through while storing them
+   class Recorder : public FrameSource {
+   public:
+      Recorder( FrameStore& store, FrameSource& source ) : store_( store ), source_( source ) {}
+      virtual bool read( cv::Mat& frame ) override;
+      bool finish(); // storing the frames the first pass didn't ask for, then finalizing the store
+
+   private:
+      FrameStore& store_;
+      FrameSource& source_;
+      bool failed_ = false;
+   };
+
+   class Reader : public FrameSource {
+   public:
+      Reader( const FrameStore& store ) : store_( store ) {}
+      virtual bool read( cv::Mat& frame ) override;
+      virtual bool skip() override;
+
+   private:
+      const FrameStore& store_;
+      size_t index_ = 0;
+   };
+
+private:
+   FrameStore( const FrameStore& ) = delete;
+   FrameStore& operator=( const FrameStore& ) = delete;
+
+   bool spill( const cv::Mat& frame );
+
+   const size_t memoryBudget_;
+   const std::string spillDirectory_;
+
+   int rows_ = 0;
+   int cols_ = 0;
+   int type_ = 0;
+   size_t frameBytes_ = 0;
+   size_t numOfFrames_ = 0;
+
+   std::vector< std::vector<unsigned char> > memoryFrames_;
+
+   int spillFd_ = -1;
+   unsigned char* spillMap_ = nullptr;
+   size_t spillBytes_ = 0;
+   bool finalized_ = false;
+};
+
+#endif /* FRAMESTORE_H */
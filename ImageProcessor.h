@@ -0,0 +1,57 @@
+#ifndef IMAGEPROCESSOR_H
+#define IMAGEPROCESSOR_H
+
+#include <string>
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include "DebugVideoSink.h"
+
+// The base of the passes: gets the frames one by one, keeps the previous one
+class ImageProcessor {
+   public:
+      virtual ~ImageProcessor() {}
+      virtual bool process( const cv::Mat& frame, bool dropped ) {
+         if ( !dropped ) {
+            if (frame.empty()) {
+                return false;
+            }
+         }
+         beforeFrame_ = frame.clone();
+         ++frameIndex_;
+         return true;
+      }
+      virtual std::string getTitle() const { return "Unititled"; }
+      const cv::Mat& getBeforeFrame() const { return beforeFrame_; }
+
+      // By default the debug images are shown in windows, the sink is optional
+      void setDebugOutput( bool showWindows, DebugVideoSink* pSink, const std::string& streamPrefix ) {
+         showWindows_ = showWindows;
+         pSink_ = pSink;
+         streamPrefix_ = streamPrefix;
+      }
+
+   protected:
+      // Debug drawing is expensive, so it should be done only if somebody is going to see it
+      bool isDebugEnabled() const {
+         return showWindows_ || ( pSink_ && pSink_->isSampled( frameIndex_ ) );
+      }
+
+      void showDebug( const std::string& name, const cv::Mat& image ) const {
+         if ( showWindows_ ) {
+            cv::imshow( name, image );
+         }
+         if ( pSink_ && pSink_->isSampled( frameIndex_ ) ) {
+            pSink_->push( streamPrefix_ + name, image );
+         }
+      }
+
+   private:
+      cv::Mat beforeFrame_;
+      long frameIndex_ = 0;
+      bool showWindows_ = true;
+      DebugVideoSink* pSink_ = nullptr;
+      std::string streamPrefix_;
+};
+
+#endif /* IMAGEPROCESSOR_H */
@@ -0,0 +1,125 @@
+#include "MismatchKernel.h"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define MISMATCH_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+   typedef long (*MismatchKernel)( const unsigned char*, size_t, const unsigned char*, size_t, int, int, long );
+
+   long countRowTail( const unsigned char* a, const unsigned char* b, int from, int width ) {
+      long mismatches = 0;
+      for ( int x = from; x < width; ++x ) {
+         mismatches += ( a[x] != b[x] );
+      }
+      return mismatches;
+   }
+
+#ifdef MISMATCH_KERNEL_X86
+   // The equal bytes are counted in 8-bit lanes (cmpeq gives -1), which are flushed into 64-bit
+   // sums by psadbw before they could overflow.
+   __attribute__((target("sse2")))
+   long countMismatchesSSE2( const unsigned char* a, size_t aStep, const unsigned char* b, size_t bStep, int width, int height, long limit ) {
+      const __m128i zero = _mm_setzero_si128();
+      long mismatches = 0;
+      for ( int y = 0; y < height; ++y, a += aStep, b += bStep ) {
+         __m128i sums = zero;
+         __m128i counts = zero;
+         int lanesUsed = 0;
+         int x = 0;
+         for ( ; x + 16 <= width; x += 16 ) {
+            const __m128i va = _mm_loadu_si128( reinterpret_cast<const __m128i*>( a + x ) );
+            const __m128i vb = _mm_loadu_si128( reinterpret_cast<const __m128i*>( b + x ) );
+            counts = _mm_sub_epi8( counts, _mm_cmpeq_epi8( va, vb ) );
+            if ( ++lanesUsed == 255 ) {
+               sums = _mm_add_epi64( sums, _mm_sad_epu8( counts, zero ) );
+               counts = zero;
+               lanesUsed = 0;
+            }
+         }
+         sums = _mm_add_epi64( sums, _mm_sad_epu8( counts, zero ) );
+         const long equal = _mm_cvtsi128_si32( sums ) + _mm_cvtsi128_si32( _mm_unpackhi_epi64( sums, sums ) );
+         mismatches += x - equal + countRowTail( a, b, x, width );
+         if ( mismatches > limit ) {
+            return mismatches;
+         }
+      }
+      return mismatches;
+   }
+
+   __attribute__((target("avx2")))
+   long countMismatchesAVX2( const unsigned char* a, size_t aStep, const unsigned char* b, size_t bStep, int width, int height, long limit ) {
+      const __m256i zero = _mm256_setzero_si256();
+      long mismatches = 0;
+      for ( int y = 0; y < height; ++y, a += aStep, b += bStep ) {
+         __m256i sums = zero;
+         __m256i counts = zero;
+         int lanesUsed = 0;
+         int x = 0;
+         for ( ; x + 32 <= width; x += 32 ) {
+            const __m256i va = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( a + x ) );
+            const __m256i vb = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( b + x ) );
+            counts = _mm256_sub_epi8( counts, _mm256_cmpeq_epi8( va, vb ) );
+            if ( ++lanesUsed == 255 ) {
+               sums = _mm256_add_epi64( sums, _mm256_sad_epu8( counts, zero ) );
+               counts = zero;
+               lanesUsed = 0;
+            }
+         }
+         sums = _mm256_add_epi64( sums, _mm256_sad_epu8( counts, zero ) );
+         const __m128i half = _mm_add_epi64( _mm256_castsi256_si128( sums ), _mm256_extracti128_si256( sums, 1 ) );
+         const long equal = _mm_cvtsi128_si32( half ) + _mm_cvtsi128_si32( _mm_unpackhi_epi64( half, half ) );
+         mismatches += x - equal + countRowTail( a, b, x, width );
+         if ( mismatches > limit ) {
+            return mismatches;
+         }
+      }
+      return mismatches;
+   }
+#endif
+
+   struct Dispatch {
+      Dispatch() : kernel( countMismatchesScalar ), name( "scalar" ) {
+#ifdef MISMATCH_KERNEL_X86
+         __builtin_cpu_init();
+         if ( __builtin_cpu_supports( "avx2" ) ) {
+            kernel = countMismatchesAVX2;
+            name = "avx2";
+         } else if ( __builtin_cpu_supports( "sse2" ) ) {
+            kernel = countMismatchesSSE2;
+            name = "sse2";
+         }
+#endif
+      }
+      MismatchKernel kernel;
+      const char* name;
+   };
+
+   const Dispatch& getDispatch() {
+      static const Dispatch dispatch;
+      return dispatch;
+   }
+}
+
+long
+countMismatchesScalar( const unsigned char* a, size_t aStep, const unsigned char* b, size_t bStep, int width, int height, long limit ) {
+   long mismatches = 0;
+   for ( int y = 0; y < height; ++y, a += aStep, b += bStep ) {
+      mismatches += countRowTail( a, b, 0, width );
+      if ( mismatches > limit ) {
+         return mismatches;
+      }
+   }
+   return mismatches;
+}
+
+long
+countMismatches( const unsigned char* a, size_t aStep, const unsigned char* b, size_t bStep, int width, int height, long limit ) {
+   return getDispatch().kernel( a, aStep, b, bStep, width, height, limit );
+}
+
+const char*
+getMismatchKernelName() {
+   return getDispatch().name;
+}
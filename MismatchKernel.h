@@ -0,0 +1,19 @@
+#ifndef MISMATCHKERNEL_H
+#define MISMATCHKERNEL_H
+
+#include <cstddef>
+#include <climits>
+
+// Counts the differing bytes of two width x height 8-bit images given by their first row and
+// their row strides. Counting stops as soon as the count exceeds the limit, then the returned
+// value is greater than the limit, but not the exact count.
+// The implementation is picked at the first call: AVX2 or SSE2 if the CPU has it, plain C++ otherwise.
+long countMismatches( const unsigned char* a, size_t aStep, const unsigned char* b, size_t bStep, int width, int height, long limit = LONG_MAX );
+
+// Name of the implementation countMismatches() is using
+const char* getMismatchKernelName();
+
+// The portable implementation, for comparison
+long countMismatchesScalar( const unsigned char* a, size_t aStep, const unsigned char* b, size_t bStep, int width, int height, long limit = LONG_MAX );
+
+#endif /* MISMATCHKERNEL_H */
@@ -0,0 +1,193 @@
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "Panorama.h"
+
+namespace {
+   struct TileUpdate {
+      cv::Mat* sums;
+      cv::Mat* numOfSamples;
+      cv::Rect imgRect;  // the updated area in the coordinates of the image
+      cv::Point tilePos; // its top left corner in the coordinates of the tile
+   };
+
+   // Every tile is updated by one thread only. The inner loop is branch free, so the compiler can
+   // vectorize it.
+   class TileAccumulator : public cv::ParallelLoopBody {
+   public:
+      TileAccumulator( const cv::Mat& img, const cv::Mat& mask, unsigned char maxNumOfSamples, const std::vector<TileUpdate>& updates )
+       : img_( img ), mask_( mask ), maxNumOfSamples_( maxNumOfSamples ), updates_( updates ) {}
+
+      virtual void operator()( const cv::Range& range ) const override {
+         for ( int i = range.start; i < range.end; ++i ) {
+            const TileUpdate& update = updates_[i];
+            const cv::Rect& rect = update.imgRect;
+            for ( int y = 0; y < rect.height; ++y ) {
+               const unsigned char* imgRow = img_.ptr<unsigned char>( rect.y + y ) + 3 * rect.x;
+               const unsigned char* maskRow = mask_.ptr<unsigned char>( rect.y + y ) + rect.x;
+               unsigned short* sumRow = update.sums->ptr<unsigned short>( update.tilePos.y + y ) + 3 * update.tilePos.x;
+               unsigned char* numRow = update.numOfSamples->ptr<unsigned char>( update.tilePos.y + y ) + update.tilePos.x;
+               for ( int x = 0; x < rect.width; ++x ) {
+                  const unsigned char add = ( maskRow[x] == 255 ) & ( numRow[x] < maxNumOfSamples_ );
+                  numRow[x] += add;
+                  sumRow[3 * x + 0] += add * imgRow[3 * x + 0];
+                  sumRow[3 * x + 1] += add * imgRow[3 * x + 1];
+                  sumRow[3 * x + 2] += add * imgRow[3 * x + 2];
+               }
+            }
+         }
+      }
+
+   private:
+      const cv::Mat& img_;
+      const cv::Mat& mask_;
+      const unsigned char maxNumOfSamples_;
+      const std::vector<TileUpdate>& updates_;
+   };
+}
+
+Panorama::Panorama( unsigned char maxNumOfSamples, int tileSize )
+ : maxNumOfSamples_( maxNumOfSamples ), tileSize_( tileSize )
+{}
+
+Panorama::Tile&
+Panorama::getTile( const TileKey& key ) {
+   auto it = tiles_.find( key );
+   if ( it == tiles_.end() ) {
+      // 255 samples of 255 still fit into 16 bits
+      Tile tile;
+      tile.sums = cv::Mat::zeros( tileSize_, tileSize_, CV_16UC3 );
+      tile.numOfSamples = cv::Mat::zeros( tileSize_, tileSize_, CV_8UC1 );
+      it = tiles_.insert( std::make_pair( key, tile ) ).first;
+   }
+   return it->second;
+}
+
+void
+Panorama::add( const cv::Mat& img, const cv::Mat& mask, int posx, int posy ) {
+   const cv::Rect imgRect( posx, posy, img.cols, img.rows );
+
+   // allocating the tiles here, so the threads don't touch the map
+   std::vector<TileUpdate> updates;
+   for ( int ty = floorDiv( posy ); ty <= floorDiv( posy + img.rows - 1 ); ++ty ) {
+      for ( int tx = floorDiv( posx ); tx <= floorDiv( posx + img.cols - 1 ); ++tx ) {
+         const TileKey key( ty, tx );
+         const cv::Rect tileRect = getTileRect( key );
+         const cv::Rect common = imgRect & tileRect;
+         const cv::Rect rectInImg( common.x - posx, common.y - posy, common.width, common.height );
+         if ( common.area() == 0 || !cv::countNonZero( mask( rectInImg ) ) ) {
+            continue; // nothing to write, no reason to allocate
+         }
+         Tile& tile = getTile( key );
+         TileUpdate update = { &tile.sums, &tile.numOfSamples, rectInImg, cv::Point( common.x - tileRect.x, common.y - tileRect.y ) };
+         updates.push_back( update );
+      }
+   }
+   cv::parallel_for_( cv::Range( 0, updates.size() ), TileAccumulator( img, mask, maxNumOfSamples_, updates ) );
+}
+
+cv::Mat
+Panorama::getSlice( const cv::Rect& rect ) const {
+   cv::Mat result( rect.size(), CV_8UC3, cv::Scalar( 0, 255, 0 ) );
+   if ( rect.area() == 0 ) {
+      return result;
+   }
+   for ( int ty = floorDiv( rect.y ); ty <= floorDiv( rect.y + rect.height - 1 ); ++ty ) {
+      for ( int tx = floorDiv( rect.x ); tx <= floorDiv( rect.x + rect.width - 1 ); ++tx ) {
+         const TileKey key( ty, tx );
+         auto it = tiles_.find( key );
+         if ( it == tiles_.end() ) {
+            continue;
+         }
+         const cv::Rect tileRect = getTileRect( key );
+         const cv::Rect common = rect & tileRect;
+         for ( int y = common.y; y < common.y + common.height; ++y ) {
+            const unsigned short* sumRow = it->second.sums.ptr<unsigned short>( y - tileRect.y ) + 3 * ( common.x - tileRect.x );
+            const unsigned char* numRow = it->second.numOfSamples.ptr<unsigned char>( y - tileRect.y ) + ( common.x - tileRect.x );
+            unsigned char* resultRow = result.ptr<unsigned char>( y - rect.y ) + 3 * ( common.x - rect.x );
+            for ( int x = 0; x < common.width; ++x ) {
+               const unsigned int num = numRow[x];
+               if ( num ) {
+                  for ( int i = 0; i < 3; ++i ) {
+                     resultRow[3 * x + i] = ( sumRow[3 * x + i] + num / 2 ) / num;
+                  }
+               }
+            }
+         }
+      }
+   }
+   return result;
+}
+
+cv::Rect
+Panorama::getBoundingBox() const {
+   int minx = 0, miny = 0, maxx = -1, maxy = -1;
+   bool empty = true;
+   for ( const auto& elem: tiles_ ) {
+      const cv::Rect tileRect = getTileRect( elem.first );
+      const cv::Mat& numOfSamples = elem.second.numOfSamples;
+      for ( int y = 0; y < numOfSamples.rows; ++y ) {
+         const unsigned char* numRow = numOfSamples.ptr<unsigned char>( y );
+         for ( int x = 0; x < numOfSamples.cols; ++x ) {
+            if ( numRow[x] ) {
+               const int px = tileRect.x + x;
+               const int py = tileRect.y + y;
+               if ( empty ) {
+                  minx = maxx = px;
+                  miny = maxy = py;
+                  empty = false;
+               } else {
+                  minx = std::min( minx, px );
+                  maxx = std::max( maxx, px );
+                  miny = std::min( miny, py );
+                  maxy = std::max( maxy, py );
+               }
+            }
+         }
+      }
+   }
+   return cv::Rect( minx, miny, maxx - minx + 1, maxy - miny + 1 );
+}
+
+bool
+Panorama::write( std::ostream& out ) const {
+   const int32_t header[3] = { tileSize_, maxNumOfSamples_, static_cast<int32_t>( tiles_.size() ) };
+   out.write( reinterpret_cast<const char*>( header ), sizeof( header ) );
+   for ( const auto& elem: tiles_ ) {
+      const int32_t key[2] = { elem.first.first, elem.first.second };
+      out.write( reinterpret_cast<const char*>( key ), sizeof( key ) );
+      for ( int y = 0; y < tileSize_; ++y ) {
+         out.write( reinterpret_cast<const char*>( elem.second.sums.ptr( y ) ), tileSize_ * elem.second.sums.elemSize() );
+      }
+      for ( int y = 0; y < tileSize_; ++y ) {
+         out.write( reinterpret_cast<const char*>( elem.second.numOfSamples.ptr( y ) ), tileSize_ );
+      }
+   }
+   return out.good();
+}
+
+bool
+Panorama::read( std::istream& in ) {
+   tiles_.clear();
+   int32_t header[3];
+   if ( !in.read( reinterpret_cast<char*>( header ), sizeof( header ) ) || header[0] != tileSize_ || header[1] != maxNumOfSamples_ ) {
+      return false;
+   }
+   for ( int32_t i = 0; i < header[2]; ++i ) {
+      int32_t key[2];
+      in.read( reinterpret_cast<char*>( key ), sizeof( key ) );
+      Tile& tile = getTile( TileKey( key[0], key[1] ) );
+      for ( int y = 0; y < tileSize_; ++y ) {
+         in.read( reinterpret_cast<char*>( tile.sums.ptr( y ) ), tileSize_ * tile.sums.elemSize() );
+      }
+      for ( int y = 0; y < tileSize_; ++y ) {
+         in.read( reinterpret_cast<char*>( tile.numOfSamples.ptr( y ) ), tileSize_ );
+      }
+      if ( !in ) {
+         tiles_.clear();
+         return false;
+      }
+   }
+   return true;
+}
@@ -0,0 +1,52 @@
+#ifndef PANORAMA_H
+#define PANORAMA_H
+
+#include <map>
+#include <utility>
+#include <istream>
+#include <ostream>
+
+#include "opencv2/core/core.hpp"
+
+// The background of the whole track, built from the frames. Tiles are allocated at the first
+// write, so it grows in any direction without a limit. Every pixel is the average of at most
+// maxNumOfSamples samples, kept as 16-bit sums and 8-bit counters until it is read.
+// Pixels without samples are green.
+class Panorama {
+public:
+   Panorama( unsigned char maxNumOfSamples = 250, int tileSize = 256 );
+
+   // Adds the pixels of img where the mask is 255, the top left corner of img is at ( posx, posy )
+   void add( const cv::Mat& img, const cv::Mat& mask, int posx, int posy );
+
+   // Any area of the panorama, not necessarily populated
+   cv::Mat getSlice( const cv::Rect& rect ) const;
+
+   // The bounding box of the pixels having at least one sample
+   cv::Rect getBoundingBox() const;
+   cv::Mat getResult() const { return getSlice( getBoundingBox() ); }
+
+   size_t getNumOfTiles() const { return tiles_.size(); }
+
+   // The raw sums and counters, so a stored panorama can be continued exactly. read() replaces the
+   // content, on failure the panorama is left empty.
+   bool write( std::ostream& out ) const;
+   bool read( std::istream& in );
+
+private:
+   struct Tile {
+      cv::Mat sums;
+      cv::Mat numOfSamples;
+   };
+   typedef std::pair<int, int> TileKey; // ( ty, tx ), so the map is ordered row by row
+
+   int floorDiv( int value ) const { return value >= 0 ? value / tileSize_ : -( ( -value + tileSize_ - 1 ) / tileSize_ ); }
+   cv::Rect getTileRect( const TileKey& key ) const { return cv::Rect( key.second * tileSize_, key.first * tileSize_, tileSize_, tileSize_ ); }
+   Tile& getTile( const TileKey& key );
+
+   const unsigned char maxNumOfSamples_;
+   const int tileSize_;
+   std::map<TileKey, Tile> tiles_;
+};
+
+#endif /* PANORAMA_H */
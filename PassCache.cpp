@@ -0,0 +1,165 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <sys/stat.h>
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include "PassCache.h"
+
+namespace {
+   const char MAGIC[8] = { 'C', 'G', 'C', 'A', 'C', 'H', 'E', '1' };
+
+   // 64-bit FNV-1a over 8 byte words, good enough to tell the videos apart
+   class Hash {
+   public:
+      void update( const unsigned char* data, size_t size ) {
+         size_t i = 0;
+         for ( ; i + 8 <= size; i += 8 ) {
+            uint64_t word;
+            memcpy( &word, data + i, 8 );
+            mix( word );
+         }
+         for ( ; i < size; ++i ) {
+            mix( data[i] );
+         }
+      }
+      void update( const std::string& text ) {
+         update( reinterpret_cast<const unsigned char*>( text.data() ), text.size() );
+      }
+      std::string getHex() const {
+         std::ostringstream out;
+         out << std::hex << std::setw(16) << std::setfill('0') << state_;
+         return out.str();
+      }
+
+   private:
+      void mix( uint64_t value ) {
+         state_ ^= value;
+         state_ *= 0x100000001b3ULL;
+      }
+
+      uint64_t state_ = 0xcbf29ce484222325ULL;
+   };
+
+   bool makeDirectories( const std::string& path ) {
+      for ( size_t pos = path.find( '/', 1 ); ; pos = path.find( '/', pos + 1 ) ) {
+         const std::string prefix = path.substr( 0, pos );
+         if ( mkdir( prefix.c_str(), 0755 ) != 0 && errno != EEXIST ) {
+            std::cerr << "Pass cache: failed to create " << prefix << ": " << strerror( errno ) << std::endl;
+            return false;
+         }
+         if ( pos == std::string::npos ) {
+            return true;
+         }
+      }
+   }
+}
+
+PassCache::PassCache( const std::string& directory )
+ : directory_( directory )
+{}
+
+bool
+PassCache::open( const std::string& inputPath ) {
+   std::ifstream in( inputPath.c_str(), std::ios::binary );
+   if ( !in ) {
+      return false;
+   }
+   Hash hash;
+   std::vector<unsigned char> buffer( 1 << 20 );
+   while ( in ) {
+      in.read( reinterpret_cast<char*>( buffer.data() ), buffer.size() );
+      hash.update( buffer.data(), in.gcount() );
+   }
+   if ( in.bad() ) {
+      return false;
+   }
+   inputHash_ = hash.getHex();
+   return makeDirectories( directory_ + "/" + inputHash_ );
+}
+
+std::string
+PassCache::getPath( const std::string& kind, const std::string& parameters, const std::string& extension ) const {
+   Hash hash;
+   hash.update( parameters );
+   return directory_ + "/" + inputHash_ + "/" + kind + "_" + hash.getHex() + extension;
+}
+
+bool
+PassCache::loadStatic( const std::string& parameters, cv::Mat& sbpResult ) const {
+   cv::Mat result = cv::imread( getPath( "static", parameters, ".png" ), 0 );
+   if ( result.empty() ) {
+      return false;
+   }
+   sbpResult = result;
+   return true;
+}
+
+bool
+PassCache::storeStatic( const std::string& parameters, const cv::Mat& sbpResult ) const {
+   // imwrite needs the extension to pick the format
+   const std::string path = getPath( "static", parameters, ".png" );
+   const std::string tmpPath = getPath( "static", parameters, ".tmp.png" );
+   return cv::imwrite( tmpPath, sbpResult ) && rename( tmpPath.c_str(), path.c_str() ) == 0;
+}
+
+bool
+PassCache::loadDynamic( const std::string& parameters, bool checkpoint, std::vector<cv::Vec2f>& trajectory, Panorama& panorama ) const {
+   std::ifstream in( getPath( "dynamic", parameters, checkpoint ? ".checkpoint" : ".bin" ).c_str(), std::ios::binary );
+   char magic[8];
+   uint32_t parametersSize = 0;
+   if ( !in.read( magic, sizeof( magic ) ) || memcmp( magic, MAGIC, sizeof( MAGIC ) ) != 0
+        || !in.read( reinterpret_cast<char*>( &parametersSize ), sizeof( parametersSize ) ) ) {
+      return false;
+   }
+   // guarding against hash collisions
+   std::string storedParameters( parametersSize, '\0' );
+   if ( !in.read( &storedParameters[0], parametersSize ) || storedParameters != parameters ) {
+      return false;
+   }
+   uint64_t numOfFrames = 0;
+   if ( !in.read( reinterpret_cast<char*>( &numOfFrames ), sizeof( numOfFrames ) ) ) {
+      return false;
+   }
+   std::vector<cv::Vec2f> shifts( numOfFrames );
+   if ( !in.read( reinterpret_cast<char*>( shifts.data() ), numOfFrames * sizeof( cv::Vec2f ) ) || !panorama.read( in ) ) {
+      return false;
+   }
+   trajectory.swap( shifts );
+   return true;
+}
+
+bool
+PassCache::storeDynamic( const std::string& parameters, bool checkpoint, const std::vector<cv::Vec2f>& trajectory, const Panorama& panorama ) const {
+   const std::string path = getPath( "dynamic", parameters, checkpoint ? ".checkpoint" : ".bin" );
+   const std::string tmpPath = path + ".tmp";
+   {
+      std::ofstream out( tmpPath.c_str(), std::ios::binary );
+      const uint32_t parametersSize = parameters.size();
+      const uint64_t numOfFrames = trajectory.size();
+      out.write( MAGIC, sizeof( MAGIC ) );
+      out.write( reinterpret_cast<const char*>( &parametersSize ), sizeof( parametersSize ) );
+      out.write( parameters.data(), parametersSize );
+      out.write( reinterpret_cast<const char*>( &numOfFrames ), sizeof( numOfFrames ) );
+      out.write( reinterpret_cast<const char*>( trajectory.data() ), numOfFrames * sizeof( cv::Vec2f ) );
+      if ( !panorama.write( out ) || !out.flush() ) {
+         std::cerr << "Pass cache: failed to write " << tmpPath << std::endl;
+         out.close();
+         remove( tmpPath.c_str() );
+         return false;
+      }
+   }
+   return rename( tmpPath.c_str(), path.c_str() ) == 0;
+}
+
+void
+PassCache::removeCheckpoint( const std::string& parameters ) const {
+   remove( getPath( "dynamic", parameters, ".checkpoint" ).c_str() );
+}
@@ -0,0 +1,45 @@
+#ifndef PASSCACHE_H
+#define PASSCACHE_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "Panorama.h"
+
+// Keeps the results of the static and the dynamic pass on the disk, so a run with the same
+// video and the same pass parameters can skip them. The entries are addressed by the hash of the
+// content of the video and the parameter string of the pass:
+//
+//   <directory>/<video hash>/static_<parameter hash>.png          the static mask
+//   <directory>/<video hash>/dynamic_<parameter hash>.bin         the shifts and the panorama
+//   <directory>/<video hash>/dynamic_<parameter hash>.checkpoint  the same, for the first frames
+//
+// Every file is written under a temporary name and renamed, so a killed run never leaves a
+// broken entry behind.
+class PassCache {
+public:
+   PassCache( const std::string& directory );
+
+   // Hashes the video, returns false if it isn't a readable file (e.g. a camera)
+   bool open( const std::string& inputPath );
+
+   bool loadStatic( const std::string& parameters, cv::Mat& sbpResult ) const;
+   bool storeStatic( const std::string& parameters, const cv::Mat& sbpResult ) const;
+
+   // The panorama has to be created with the same tile size and number of samples
+   bool loadDynamic( const std::string& parameters, bool checkpoint, std::vector<cv::Vec2f>& trajectory, Panorama& panorama ) const;
+   bool storeDynamic( const std::string& parameters, bool checkpoint, const std::vector<cv::Vec2f>& trajectory, const Panorama& panorama ) const;
+   void removeCheckpoint( const std::string& parameters ) const;
+
+   const std::string& getInputHash() const { return inputHash_; }
+
+private:
+   std::string getPath( const std::string& kind, const std::string& parameters, const std::string& extension ) const;
+
+   const std::string directory_;
+   std::string inputHash_;
+};
+
+#endif /* PASSCACHE_H */
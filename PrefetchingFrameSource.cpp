@@ -0,0 +1,76 @@
+#include <chrono>
+
+#include "PrefetchingFrameSource.h"
+
+namespace {
+   // Spinning is fine for a short while, but the other side may be a slow decoder
+   void backoff( int& spins ) {
+      if ( spins < 64 ) {
+         ++spins;
+         std::this_thread::yield();
+      } else {
+         std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+      }
+   }
+}
+
+PrefetchingFrameSource::PrefetchingFrameSource( FrameSource& source, size_t numOfSlots )
+ : source_( source ), slots_( numOfSlots > 1 ? numOfSlots : 2 ), head_( 0 ), tail_( 0 ), stopping_( false ),
+   thread_( &PrefetchingFrameSource::run, this )
+{}
+
+PrefetchingFrameSource::~PrefetchingFrameSource() {
+   stopping_.store( true );
+   thread_.join();
+}
+
+void
+PrefetchingFrameSource::run() {
+   for (;;) {
+      const size_t head = head_.load( std::memory_order_relaxed );
+      int spins = 0;
+      while ( head - tail_.load( std::memory_order_acquire ) >= slots_.size() ) { // full
+         if ( stopping_.load( std::memory_order_relaxed ) ) {
+            return;
+         }
+         backoff( spins );
+      }
+
+      cv::Mat& slot = slots_[ head % slots_.size() ];
+      const bool success = source_.read( slot );
+      if ( !success ) {
+         slot.release(); // an empty slot marks the end of the stream
+      }
+      head_.store( head + 1, std::memory_order_release );
+      if ( !success || stopping_.load( std::memory_order_relaxed ) ) {
+         return;
+      }
+   }
+}
+
+bool
+PrefetchingFrameSource::read( cv::Mat& frame ) {
+   if ( finished_ ) {
+      frame.release();
+      return false;
+   }
+
+   size_t tail = tail_.load( std::memory_order_relaxed );
+   if ( holding_ ) {
+      tail_.store( ++tail, std::memory_order_release );
+      holding_ = false;
+   }
+
+   int spins = 0;
+   while ( head_.load( std::memory_order_acquire ) == tail ) { // empty
+      backoff( spins );
+   }
+
+   frame = slots_[ tail % slots_.size() ];
+   if ( frame.empty() ) {
+      finished_ = true;
+      return false;
+   }
+   holding_ = true;
+   return true;
+}
@@ -0,0 +1,39 @@
+#ifndef PREFETCHINGFRAMESOURCE_H
+#define PREFETCHINGFRAMESOURCE_H
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "FrameSource.h"
+
+// Reads the wrapped source on its own thread into a bounded ring of frame slots, so decoding
+// overlaps with the processing. Single producer, single consumer, no locks: the decoder waits
+// while the ring is full, the consumer waits while it is empty.
+//
+// The frame returned by read() refers to a slot of the ring, it stays valid until the next read().
+class PrefetchingFrameSource : public FrameSource {
+public:
+   PrefetchingFrameSource( FrameSource& source, size_t numOfSlots = 8 );
+   virtual ~PrefetchingFrameSource();
+   virtual bool read( cv::Mat& frame ) override;
+
+private:
+   PrefetchingFrameSource( const PrefetchingFrameSource& ) = delete;
+   PrefetchingFrameSource& operator=( const PrefetchingFrameSource& ) = delete;
+
+   void run();
+
+   FrameSource& source_;
+   std::vector<cv::Mat> slots_; // allocated at the first round, reused afterwards
+
+   std::atomic<size_t> head_; // next slot the decoder fills, written only by the decoder
+   std::atomic<size_t> tail_; // oldest slot not yet given back, written only by the consumer
+   std::atomic<bool> stopping_;
+   bool holding_ = false;     // the consumer still uses the slot at tail_
+   bool finished_ = false;
+
+   std::thread thread_;
+};
+
+#endif /* PREFETCHINGFRAMESOURCE_H */
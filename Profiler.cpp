@@ -0,0 +1,155 @@
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+
+#include <sys/resource.h>
+
+#include "Profiler.h"
+
+Profiler&
+Profiler::getInstance() {
+   static Profiler profiler;
+   return profiler;
+}
+
+bool
+Profiler::isEnabled() {
+#ifdef ENABLE_PROFILING
+   return true;
+#else
+   return false;
+#endif
+}
+
+thread_local Profiler::TraceBuffer* Profiler::pTraceBuffer_ = nullptr;
+
+Profiler::Stage::Stage()
+ : count( 0 ), numOfFrames( 0 ), totalNs( 0 ), maxNs( 0 )
+{
+   for ( auto& elem: histogram ) {
+      elem.store( 0, std::memory_order_relaxed );
+   }
+}
+
+Profiler::Profiler()
+ : origin_( std::chrono::steady_clock::now() )
+{}
+
+int
+Profiler::getBucket( uint64_t ns ) {
+   if ( ns < SUB_BUCKETS ) {
+      return ns;
+   }
+   const int octave = 63 - __builtin_clzll( ns );
+   const int sub = ( ns >> ( octave - 3 ) ) & ( SUB_BUCKETS - 1 ); // the 3 bits after the leading one
+   return octave * SUB_BUCKETS + sub;
+}
+
+double
+Profiler::getBucketValue( int bucket ) {
+   if ( bucket < SUB_BUCKETS ) {
+      return bucket;
+   }
+   // the middle of the bucket
+   const int octave = bucket / SUB_BUCKETS;
+   const int sub = bucket % SUB_BUCKETS;
+   return std::ldexp( 1.0 + ( sub + 0.5 ) / SUB_BUCKETS, octave );
+}
+
+Profiler::TraceBuffer&
+Profiler::getTraceBuffer() {
+   if ( !pTraceBuffer_ ) {
+      std::lock_guard<std::mutex> lock( mutex_ );
+      traceBuffers_.emplace_back( new TraceBuffer() );
+      pTraceBuffer_ = traceBuffers_.back().get();
+   }
+   return *pTraceBuffer_;
+}
+
+Profiler::Stage&
+Profiler::getStage( const char* name ) {
+   std::lock_guard<std::mutex> lock( mutex_ );
+   Stage& stage = stages_[ name ];
+   if ( !stage.name ) {
+      stage.name = name; // before any call site gets the stage, later it is only read
+   }
+   return stage;
+}
+
+void
+Profiler::record( Stage& stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end ) {
+   const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>( end - start ).count();
+   stage.count.fetch_add( 1, std::memory_order_relaxed );
+   stage.totalNs.fetch_add( ns, std::memory_order_relaxed );
+   uint64_t maxNs = stage.maxNs.load( std::memory_order_relaxed );
+   while ( ns > maxNs && !stage.maxNs.compare_exchange_weak( maxNs, ns, std::memory_order_relaxed ) ) {
+   }
+   stage.histogram[ getBucket( ns ) ].fetch_add( 1, std::memory_order_relaxed );
+   if ( traceEnabled_ ) {
+      const uint64_t startNs = std::chrono::duration_cast<std::chrono::nanoseconds>( start - origin_ ).count();
+      getTraceBuffer().events.push_back( TraceEvent{ stage.name, startNs, ns } );
+   }
+}
+
+void
+Profiler::addFrames( const char* name, long numOfFrames ) {
+   getStage( name ).numOfFrames.fetch_add( numOfFrames, std::memory_order_relaxed );
+}
+
+double
+Profiler::getPercentile( const Stage& stage, double ratio ) const {
+   const double target = ratio * stage.count;
+   long sum = 0;
+   for ( int i = 0; i < NUM_OF_BUCKETS; ++i ) {
+      const uint32_t inBucket = stage.histogram[i].load( std::memory_order_relaxed );
+      sum += inBucket;
+      if ( sum >= target && inBucket ) {
+         return std::min( getBucketValue( i ), static_cast<double>( stage.maxNs ) );
+      }
+   }
+   return stage.maxNs;
+}
+
+bool
+Profiler::writeReport( const std::string& path ) const {
+   std::lock_guard<std::mutex> lock( mutex_ );
+   std::ofstream out( path.c_str() );
+   struct rusage usage;
+   getrusage( RUSAGE_SELF, &usage );
+
+   out << std::fixed << std::setprecision(3) << "{\n  \"peak_rss_kb\": " << usage.ru_maxrss << ",\n  \"stages\": [";
+   bool first = true;
+   for ( const auto& elem: stages_ ) {
+      const Stage& stage = elem.second;
+      out << ( first ? "\n" : ",\n" ) << "    { \"name\": \"" << elem.first << "\", \"count\": " << stage.count
+          << ", \"total_ms\": " << stage.totalNs / 1e6
+          << ", \"mean_us\": " << ( stage.count ? stage.totalNs / 1e3 / stage.count : 0. )
+          << ", \"p50_us\": " << getPercentile( stage, 0.5 ) / 1e3
+          << ", \"p99_us\": " << getPercentile( stage, 0.99 ) / 1e3
+          << ", \"max_us\": " << stage.maxNs / 1e3;
+      if ( stage.numOfFrames ) {
+         out << ", \"frames\": " << stage.numOfFrames << ", \"fps\": " << ( stage.totalNs ? stage.numOfFrames * 1e9 / stage.totalNs : 0. );
+      }
+      out << " }";
+      first = false;
+   }
+   out << "\n  ]\n}\n";
+   return out.good();
+}
+
+bool
+Profiler::writeTrace( const std::string& path ) const {
+   std::lock_guard<std::mutex> lock( mutex_ );
+   std::ofstream out( path.c_str() );
+   out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+   bool first = true;
+   for ( size_t thread = 0; thread < traceBuffers_.size(); ++thread ) {
+      for ( const TraceEvent& event: traceBuffers_[thread]->events ) {
+         out << ( first ? "\n" : ",\n" ) << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+             << ",\"ts\":" << event.startNs / 1e3 << ",\"dur\":" << event.durationNs / 1e3 << "}";
+         first = false;
+      }
+   }
+   out << "\n]}\n";
+   return out.good();
+}
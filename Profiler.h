@@ -0,0 +1,103 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Per stage latency histograms, frames per second of the passes and the peak memory, written as
+// a JSON report, optionally with a Chrome trace (chrome://tracing, Perfetto) of every timed scope.
+//
+// The hot path uses the macros only, which compile to nothing unless ENABLE_PROFILING is defined
+// (make PROFILE=1). The stage names have to be string literals. Every call site looks its stage up
+// only once, after that a timed scope takes no lock: the stage is updated by atomics and the trace
+// events go to a buffer of the thread.
+#ifdef ENABLE_PROFILING
+#define PROFILE_CONCAT_IMPL( a, b ) a##b
+#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT_IMPL( a, b )
+#define PROFILE_SCOPE( name ) \
+   static Profiler::Stage& PROFILE_CONCAT( profileStage, __LINE__ ) = Profiler::getInstance().getStage( name ); \
+   Profiler::ScopedTimer PROFILE_CONCAT( profileScope, __LINE__ )( PROFILE_CONCAT( profileStage, __LINE__ ) )
+#define PROFILE_FRAMES( name, numOfFrames ) Profiler::getInstance().addFrames( name, numOfFrames )
+#else
+#define PROFILE_SCOPE( name ) do {} while ( false )
+#define PROFILE_FRAMES( name, numOfFrames ) do {} while ( false )
+#endif
+
+class Profiler {
+   // Log scale buckets, 8 per octave of nanoseconds, so the percentiles are within 10%
+   static const int SUB_BUCKETS = 8;
+   static const int NUM_OF_BUCKETS = 64 * SUB_BUCKETS;
+
+public:
+   // The statistics of the scopes with the same name, updated from any thread without a lock
+   struct Stage {
+      Stage();
+
+      const char* name = nullptr;
+      std::atomic<long> count;
+      std::atomic<long> numOfFrames;
+      std::atomic<uint64_t> totalNs;
+      std::atomic<uint64_t> maxNs;
+      std::atomic<uint32_t> histogram[NUM_OF_BUCKETS];
+   };
+
+   static Profiler& getInstance();
+   static bool isEnabled();
+
+   // Set before the timed threads start
+   void enableTrace( bool enable ) { traceEnabled_ = enable; }
+
+   // The stage lives as long as the profiler, so a call site can keep it
+   Stage& getStage( const char* name );
+   void record( Stage& stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end );
+   // The frames processed in a stage, for the frames per second
+   void addFrames( const char* name, long numOfFrames );
+
+   bool writeReport( const std::string& path ) const;
+   // The trace buffers of the threads are read without a lock, the timed threads have to be finished
+   bool writeTrace( const std::string& path ) const;
+
+   class ScopedTimer {
+   public:
+      ScopedTimer( Stage& stage ) : stage_( stage ), start_( std::chrono::steady_clock::now() ) {}
+      ~ScopedTimer() { Profiler::getInstance().record( stage_, start_, std::chrono::steady_clock::now() ); }
+
+   private:
+      Stage& stage_;
+      const std::chrono::steady_clock::time_point start_;
+   };
+
+private:
+   Profiler();
+
+   struct TraceEvent {
+      const char* name;
+      uint64_t startNs;
+      uint64_t durationNs;
+   };
+
+   // Written only by its thread, the index of the buffer is the thread id in the trace
+   struct TraceBuffer {
+      std::vector<TraceEvent> events;
+   };
+
+   static int getBucket( uint64_t ns );
+   static double getBucketValue( int bucket );
+   double getPercentile( const Stage& stage, double ratio ) const;
+   TraceBuffer& getTraceBuffer();
+
+   mutable std::mutex mutex_; // for the maps and the list of the trace buffers
+   const std::chrono::steady_clock::time_point origin_;
+   bool traceEnabled_ = false;
+   std::map<std::string, Stage> stages_;
+   std::vector<std::unique_ptr<TraceBuffer>> traceBuffers_;
+   static thread_local TraceBuffer* pTraceBuffer_;
+};
+
+#endif /* PROFILER_H */
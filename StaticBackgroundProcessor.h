@@ -0,0 +1,89 @@
+#ifndef STATICBACKGROUNDPROCESSOR_H
+#define STATICBACKGROUNDPROCESSOR_H
+
+#include <cassert>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "ImageProcessor.h"
+#include "Profiler.h"
+
+// The mask of the pixels which hardly ever change, e.g. the HUD
+class StaticBackgroundProcessor : public ImageProcessor {
+   public:
+      // With convergenceFrames > 0 the pass ends as soon as the result didn't change for that many frames
+      StaticBackgroundProcessor( int param = 200, int convergenceFrames = 0 ) : param_( param ), convergenceFrames_( convergenceFrames ) {}
+      virtual bool process( const cv::Mat& frame, bool dropped ) override {
+         PROFILE_SCOPE( "static mask" );
+         if ( !dropped ) {
+            if (frame.empty()) {
+               return false;
+            }
+
+            cv::Mat diff(getBeforeFrame().size(), getBeforeFrame().type());
+            cv::absdiff(getBeforeFrame(), frame, diff);
+            cv::Mat grayscaleMat( getBeforeFrame().size(), CV_8U);
+            cv::cvtColor( diff, grayscaleMat, CV_BGR2GRAY );
+            cv::Mat binaryMaskMat(grayscaleMat.size(), grayscaleMat.type());
+            cv::threshold(grayscaleMat, binaryMaskMat, 0, 255, cv::THRESH_BINARY_INV);
+
+            // Counting how many times the pixels were unchanged
+            if ( unchangedCounter_.empty() ) {
+               unchangedCounter_ = cv::Mat::zeros( frame.size(), CV_32S );
+            }
+            cv::add( unchangedCounter_, cv::Scalar( 1 ), unchangedCounter_, binaryMaskMat );
+            counter_++;
+
+            if ( convergenceFrames_ > 0 ) {
+               cv::Mat result = getResult();
+               if ( !previousResult_.empty() && !cv::countNonZero( result != previousResult_ ) ) {
+                  ++stableFrames_;
+               } else {
+                  stableFrames_ = 0;
+               }
+               previousResult_ = result;
+               if ( stableFrames_ >= convergenceFrames_ ) {
+                  return false;
+               }
+            }
+
+            if ( isDebugEnabled() ) {
+               showDebug( "binary", getResult() );
+            }
+         }
+
+         ImageProcessor::process( frame, dropped );
+         return true;
+      }
+
+      virtual std::string getTitle() const override { return "Processing"; }
+
+      // The pixels unchanged in more than param / 255 of the frames
+      const cv::Mat getResult() const {
+         assert( !unchangedCounter_.empty() );
+         cv::Mat resultImage( unchangedCounter_.size(), CV_8U);
+         // rounded 255 * unchanged / counter > param, without floating point
+         const long long limit = ( 2LL * param_ + 1 ) * counter_;
+         for ( int y = 0; y < resultImage.rows; ++y ) {
+            const int* counterRow = unchangedCounter_.ptr<int>( y );
+            unsigned char* resultRow = resultImage.ptr<unsigned char>( y );
+            for ( int x = 0; x < resultImage.cols; ++x ) {
+               resultRow[x] = ( 2LL * 255 * counterRow[x] > limit ) ? 255 : 0;
+            }
+         }
+         return resultImage;
+      }
+
+      // Number of the frames the result is based on
+      int getNumOfFrames() const { return counter_; }
+
+   private:
+      cv::Mat unchangedCounter_;
+      cv::Mat previousResult_;
+      int counter_ = 0;
+      int param_;
+      const int convergenceFrames_;
+      int stableFrames_ = 0;
+};
+
+#endif /* STATICBACKGROUNDPROCESSOR_H */
@@ -0,0 +1,174 @@
+#include <iostream>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "TrajectoryFile.h"
+
+using namespace TrajectoryFile;
+
+BinaryTrajectoryWriter::BinaryTrajectoryWriter( const std::string& path, uint32_t rowGroupSize )
+ : file_( fopen( path.c_str(), "wb" ) ), rowGroupSize_( rowGroupSize > 0 ? rowGroupSize : 1 )
+{
+   if ( !file_ ) {
+      std::cerr << "Trajectory file: failed to create " << path << ": " << strerror( errno ) << std::endl;
+      return;
+   }
+   FileHeader header;
+   memset( &header, 0, sizeof( header ) );
+   memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+   header.version = VERSION;
+   header.rowGroupSize = rowGroupSize_;
+   writeBytes( &header, sizeof( header ) );
+}
+
+BinaryTrajectoryWriter::~BinaryTrajectoryWriter() {
+   close();
+}
+
+void
+BinaryTrajectoryWriter::write( const TrajectoryRow& row ) {
+   x_.push_back( row.x );
+   y_.push_back( row.y );
+   angle_.push_back( row.angle );
+   frame_.push_back( row.frame );
+   shiftx_.push_back( row.shiftx );
+   shifty_.push_back( row.shifty );
+   valid_.push_back( row.valid );
+   ++numOfRows_;
+   if ( x_.size() == rowGroupSize_ ) {
+      flushRowGroup();
+   }
+}
+
+bool
+BinaryTrajectoryWriter::close() {
+   if ( !file_ ) {
+      return false;
+   }
+   flushRowGroup();
+   // the number of rows is known only now
+   if ( fseek( file_, offsetof( FileHeader, numOfRows ), SEEK_SET ) == 0 ) {
+      writeBytes( &numOfRows_, sizeof( numOfRows_ ) );
+   } // not seekable (a pipe), the readers count the rows anyway
+   if ( fclose( file_ ) != 0 ) {
+      failed_ = true;
+   }
+   file_ = nullptr;
+   return !failed_;
+}
+
+void
+BinaryTrajectoryWriter::flushRowGroup() {
+   const size_t n = x_.size();
+   if ( !n || !file_ ) {
+      return;
+   }
+   RowGroupHeader header = { static_cast<uint32_t>( n ), 0 };
+   writeBytes( &header, sizeof( header ) );
+   writeBytes( x_.data(), n * sizeof( double ) );
+   writeBytes( y_.data(), n * sizeof( double ) );
+   writeBytes( angle_.data(), n * sizeof( double ) );
+   writeBytes( frame_.data(), n * sizeof( int32_t ) );
+   writeBytes( shiftx_.data(), n * sizeof( float ) );
+   writeBytes( shifty_.data(), n * sizeof( float ) );
+   writeBytes( valid_.data(), n );
+   const size_t padding = getRowGroupBytes( n ) - ( sizeof( header ) + n * ( 3 * sizeof( double ) + sizeof( int32_t ) + 2 * sizeof( float ) + 1 ) );
+   const char zeros[8] = { 0 };
+   writeBytes( zeros, padding );
+
+   x_.clear();
+   y_.clear();
+   angle_.clear();
+   frame_.clear();
+   shiftx_.clear();
+   shifty_.clear();
+   valid_.clear();
+}
+
+void
+BinaryTrajectoryWriter::writeBytes( const void* data, size_t size ) {
+   if ( size && fwrite( data, 1, size, file_ ) != size ) {
+      if ( !failed_ ) {
+         std::cerr << "Trajectory file: failed to write: " << strerror( errno ) << std::endl;
+      }
+      failed_ = true;
+   }
+}
+
+TrajectoryFileReader::TrajectoryFileReader()
+{}
+
+TrajectoryFileReader::~TrajectoryFileReader() {
+   if ( map_ ) {
+      munmap( map_, mapBytes_ );
+   }
+}
+
+bool
+TrajectoryFileReader::open( const std::string& path ) {
+   const int fd = ::open( path.c_str(), O_RDONLY );
+   if ( fd < 0 ) {
+      std::cerr << "Trajectory file: failed to open " << path << ": " << strerror( errno ) << std::endl;
+      return false;
+   }
+   struct stat info;
+   if ( fstat( fd, &info ) != 0 || static_cast<size_t>( info.st_size ) < sizeof( FileHeader ) ) {
+      std::cerr << "Trajectory file: " << path << " is too short" << std::endl;
+      ::close( fd );
+      return false;
+   }
+   mapBytes_ = info.st_size;
+   map_ = mmap( nullptr, mapBytes_, PROT_READ, MAP_PRIVATE, fd, 0 );
+   ::close( fd ); // the mapping keeps the file
+   if ( map_ == MAP_FAILED ) {
+      std::cerr << "Trajectory file: failed to map " << path << ": " << strerror( errno ) << std::endl;
+      map_ = nullptr;
+      return false;
+   }
+
+   const char* data = static_cast<const char*>( map_ );
+   const FileHeader* header = reinterpret_cast<const FileHeader*>( data );
+   if ( memcmp( header->magic, MAGIC, sizeof( MAGIC ) ) != 0 || header->version != VERSION ) {
+      std::cerr << "Trajectory file: " << path << " is not a trajectory file of version " << VERSION << std::endl;
+      return false;
+   }
+   rowGroupSize_ = header->rowGroupSize;
+
+   size_t offset = sizeof( FileHeader );
+   while ( offset + sizeof( RowGroupHeader ) <= mapBytes_ ) {
+      const RowGroupHeader* groupHeader = reinterpret_cast<const RowGroupHeader*>( data + offset );
+      const size_t n = groupHeader->numOfRows;
+      if ( !n || n > rowGroupSize_ || offset + getRowGroupBytes( n ) > mapBytes_ ) {
+         std::cerr << "Trajectory file: " << path << " is truncated after " << numOfRows_ << " rows" << std::endl;
+         break;
+      }
+      const char* column = data + offset + sizeof( RowGroupHeader );
+      RowGroup group;
+      group.numOfRows = n;
+      group.x      = reinterpret_cast<const double*>( column );   column += n * sizeof( double );
+      group.y      = reinterpret_cast<const double*>( column );   column += n * sizeof( double );
+      group.angle  = reinterpret_cast<const double*>( column );   column += n * sizeof( double );
+      group.frame  = reinterpret_cast<const int32_t*>( column );  column += n * sizeof( int32_t );
+      group.shiftx = reinterpret_cast<const float*>( column );    column += n * sizeof( float );
+      group.shifty = reinterpret_cast<const float*>( column );    column += n * sizeof( float );
+      group.valid  = reinterpret_cast<const uint8_t*>( column );
+      rowGroups_.push_back( group );
+      numOfRows_ += n;
+      offset += getRowGroupBytes( n );
+   }
+   return true;
+}
+
+TrajectoryRow
+TrajectoryFileReader::at( size_t index ) const {
+   // every row group but the last one is full
+   const RowGroup& group = rowGroups_[ index / rowGroupSize_ ];
+   const size_t i = index % rowGroupSize_;
+   return TrajectoryRow{ group.x[i], group.y[i], group.angle[i], group.valid[i] != 0, group.frame[i], group.shiftx[i], group.shifty[i] };
+}
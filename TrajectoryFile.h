@@ -0,0 +1,104 @@
+#ifndef TRAJECTORYFILE_H
+#define TRAJECTORYFILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "TrajectoryWriter.h"
+
+// Binary trajectory file, columnar in row groups, so it can be written while the rows come:
+//
+//   file header  | row group | row group | ...
+//   row group:     header, then the columns x, y, angle (double), frame (int32),
+//                  shiftx, shifty (float, since the previous row), valid (uint8), padded to 8 bytes
+//
+// Every row group but the last one has rowGroupSize rows. The number of rows in the file header
+// is written at close, a reader doesn't depend on it. Native byte order (little endian).
+namespace TrajectoryFile {
+   const char MAGIC[8] = { 'C', 'G', 'T', 'R', 'A', 'J', '\0', '\0' };
+   const uint32_t VERSION = 1;
+
+   struct FileHeader {
+      char magic[8];
+      uint32_t version;
+      uint32_t rowGroupSize;
+      uint64_t numOfRows;
+      uint64_t reserved;
+   };
+
+   struct RowGroupHeader {
+      uint32_t numOfRows;
+      uint32_t reserved;
+   };
+
+   // The size of a row group with n rows, including its header
+   inline size_t getRowGroupBytes( size_t n ) {
+      const size_t bytes = sizeof( RowGroupHeader ) + n * ( 3 * sizeof( double ) + sizeof( int32_t ) + 2 * sizeof( float ) + 1 );
+      return ( bytes + 7 ) & ~static_cast<size_t>( 7 );
+   }
+}
+
+class BinaryTrajectoryWriter : public TrajectoryWriter {
+public:
+   BinaryTrajectoryWriter( const std::string& path, uint32_t rowGroupSize = 4096 );
+   ~BinaryTrajectoryWriter();
+
+   virtual void write( const TrajectoryRow& row ) override;
+
+   // Writes the last row group and the number of rows, returns false if anything failed
+   bool close();
+   bool isGood() const { return file_ && !failed_; }
+
+private:
+   void flushRowGroup();
+   void writeBytes( const void* data, size_t size );
+
+   FILE* file_;
+   const uint32_t rowGroupSize_;
+   uint64_t numOfRows_ = 0;
+   bool failed_ = false;
+   std::vector<double> x_, y_, angle_;
+   std::vector<int32_t> frame_;
+   std::vector<float> shiftx_, shifty_;
+   std::vector<uint8_t> valid_;
+};
+
+// Maps the whole file, the columns are read in place
+class TrajectoryFileReader {
+public:
+   struct RowGroup {
+      size_t numOfRows;
+      const double* x;
+      const double* y;
+      const double* angle;
+      const int32_t* frame;
+      const float* shiftx;
+      const float* shifty;
+      const uint8_t* valid;
+   };
+
+   TrajectoryFileReader();
+   ~TrajectoryFileReader();
+
+   bool open( const std::string& path );
+
+   size_t size() const { return numOfRows_; }
+   TrajectoryRow at( size_t index ) const;
+
+   size_t getNumOfRowGroups() const { return rowGroups_.size(); }
+   const RowGroup& getRowGroup( size_t index ) const { return rowGroups_[ index ]; }
+
+private:
+   TrajectoryFileReader( const TrajectoryFileReader& ) = delete;
+   TrajectoryFileReader& operator=( const TrajectoryFileReader& ) = delete;
+
+   void* map_ = nullptr;
+   size_t mapBytes_ = 0;
+   size_t rowGroupSize_ = 0;
+   size_t numOfRows_ = 0;
+   std::vector<RowGroup> rowGroups_;
+};
+
+#endif /* TRAJECTORYFILE_H */
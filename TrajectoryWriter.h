@@ -0,0 +1,63 @@
+#ifndef TRAJECTORYWRITER_H
+#define TRAJECTORYWRITER_H
+
+#include <ostream>
+#include <iomanip>
+
+// One detected position of the car, final as soon as it is written. Frames without a detected
+// car have no row, the frame index tells where the row belongs to, and their shifts of the
+// background are added to the next row.
+struct TrajectoryRow {
+   double x;
+   double y;
+   double angle;
+   bool valid;
+   int frame; // index of the frame in the video from 0, the shift i of the trajectory leads to frame i + 1
+   float shiftx; // the shift of the background since the previous row
+   float shifty;
+};
+
+class TrajectoryWriter {
+public:
+   virtual ~TrajectoryWriter() {}
+   virtual void write( const TrajectoryRow& row ) = 0;
+};
+
+// The original "X Y ANGLE VALID" text output, every row is flushed
+class TextTrajectoryWriter : public TrajectoryWriter {
+public:
+   TextTrajectoryWriter( std::ostream& out ) : out_( out ) {
+      out_ << "X Y ANGLE VALID" << std::endl;
+   }
+   virtual void write( const TrajectoryRow& row ) override {
+      out_ << std::fixed << std::setprecision(5) << row.x << " " << row.y << " " << row.angle << " " << row.valid << std::endl;
+   }
+
+private:
+   std::ostream& out_;
+};
+
+// For an analysis on decimated frames: the rows are given in the undistorted pixels of the
+// decimated frames, written in the pixels of the video. The centre of the decimated pixel x is at
+// x * scale + ( scale - 1 ) / 2, the y axis is stretched by the distortion.
+class ScalingTrajectoryWriter : public TrajectoryWriter {
+public:
+   ScalingTrajectoryWriter( TrajectoryWriter& writer, int scale, double distortion )
+    : writer_( writer ), scale_( scale ), offsetx_( ( scale - 1 ) / 2. ), offsety_( ( scale - 1 ) / 2. * distortion ) {}
+   virtual void write( const TrajectoryRow& row ) override {
+      TrajectoryRow scaled = row;
+      scaled.x = row.x * scale_ + offsetx_;
+      scaled.y = row.y * scale_ + offsety_;
+      scaled.shiftx = row.shiftx * scale_;
+      scaled.shifty = row.shifty * scale_;
+      writer_.write( scaled );
+   }
+
+private:
+   TrajectoryWriter& writer_;
+   const int scale_;
+   const double offsetx_;
+   const double offsety_;
+};
+
+#endif /* TRAJECTORYWRITER_H */
@@ -2,780 +2,683 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <stdio.h>
 #include <sstream>
 #include <iomanip>
 #include <map>
 #include <set>
+#include <fstream>
+#include <memory>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <csignal>
+
+#include "DebugVideoSink.h"
+#include "FrameSource.h"
+#include "FrameStore.h"
+#include "PrefetchingFrameSource.h"
+#include "DecimatingFrameSource.h"
+#include "Panorama.h"
+#include "StaticBackgroundProcessor.h"
+#include "DynamicBackgroundProcessor.h"
+#include "CarProcessor.h"
+#include "TrajectoryWriter.h"
+#include "TrajectoryFile.h"
+#include "BatchRunner.h"
+#include "PassCache.h"
+#include "Profiler.h"
 
 using namespace cv;
 using namespace std;
 
-const unsigned char MAX_NUM_OF_SAMPLES_IN_AVERAGE_IMAGE = 250;
-const bool MERGE_PREVIOUS_DIFF = false;
-
 namespace {
     void help(char** av) {
        std::cout << "\nDo the analysis and extract the physics of a simple car game\n"
-                 << "Usage: " << av[0] << " <video device number>\n"
-                 << "OR   : " << av[0] << " <.avi filename>\n"
+                 << "Usage: " << av[0] << " [options] <video device number>\n"
+                 << "OR   : " << av[0] << " [options] <.avi filename>\n"
+                 << "OR   : " << av[0] << " [options] --batch <directory or list file>\n"
+                 << "Options:\n"
+                 << "  --headless               no windows and no debug drawing\n"
+                 << "  --batch                  processing every video of a directory or a list file, always headless\n"
+                 << "  --jobs <n>               number of videos processed at the same time in batch mode (default: 2)\n"
+                 << "  --max-threads <n>        number of OpenCV worker threads shared by the jobs (default: number of cores)\n"
+                 << "  --output-dir <dir>       where <name>_background.png and <name>_trajectory.txt are written in batch mode (default: .)\n"
+                 << "  --debug-video <prefix>   writing the debug overlays into <prefix>_<stream>.avi files\n"
+                 << "  --debug-video-rate <n>   writing only every n-th frame of the debug overlays (default: 1)\n"
+                 << "  --binary-trajectory      writing the trajectory into car_game_trajectory.bin (<name>_trajectory.bin in batch mode) instead of text\n"
+                 << "  --online                 single pass: learning the static mask on the warm-up frames, then tracking with a bounded lag,\n"
+                 << "                           q or Ctrl-C ends the capture and writes the results\n"
+                 << "  --warmup <n>             number of frames the static mask is learned from in online mode (default: 300)\n"
+                 << "  --lag <n>                number of frames the car tracking is behind the background in online mode (default: 30)\n"
+                 << "  --static-convergence <n> ending the static background pass when its result didn't change for n frames (default: 0, never)\n"
+                 << "  --frame-budget <MB>      memory for keeping the decoded frames between the passes, shared by the jobs (default: 2048)\n"
+                 << "  --spill-dir <dir>        where the frames over the budget are spilled (default: /tmp)\n"
+                 << "  --profile <file>         writing the per stage timings into a JSON report (make PROFILE=1 builds only)\n"
+                 << "  --trace <file>           writing every timed scope into a Chrome trace file (make PROFILE=1 builds only)\n"
+                 << "  --cache-dir <dir>        reusing the results of the static and dynamic passes stored here by earlier runs\n"
+                 << "  --checkpoint-interval <n> storing the state of the dynamic pass into the cache after every n frames (default: 1000)\n"
+                 << "  --prefetch <n>           number of frames decoded ahead on a separate thread, 0: no decoder thread (default: 8)\n"
+                 << "  --car-roi <n>            tracking the car only around its last position, the margin in pixels, 0: off (default: 0)\n"
+                 << "  --stride <n>             analysing only every n-th frame in every pass, the others are not even decoded (default: 1)\n"
+                 << "  --static-stride <n>      analysing every n-th frame in the static background pass, a multiple of the dynamic stride\n"
+                 << "  --dynamic-stride <n>     analysing every n-th frame in the dynamic background pass, the shift window grows with it\n"
+                 << "  --car-stride <n>         analysing every n-th frame in the car pass, a multiple of the dynamic stride, the positions\n"
+                 << "                           of the frames in between are interpolated\n"
+                 << "  --upscale <n>|auto       the integer factor the video is upscaled by from the resolution of the game, the\n"
+                 << "                           frames are analysed at the resolution of the game, auto: detected (default: 1)\n"
+                 << "  --downscale <n>          analysing the frames downscaled further by this integer factor (default: 1)\n"
+                 << "  --maxstep <n>            maximal shift of the background between two frames (default: 10)\n"
+                 << "  --shift-engine <name>    brute, pyramid, phase or predictive (default: brute)\n"
+                 << "                           only brute gives the foreground mask of the original scan on the frame borders\n"
+                 << "  --pyramid-levels <n>     number of downsampled levels of the pyramid engine (default: 2)\n"
+                 << "  --phase-min-response <r> weakest phase correlation peak accepted without brute force (default: 0.1)\n"
+                 << "  --predictive-radius <n>  radius of the window around the predicted shift (default: 2)\n"
+                 << "  --predictive-max-residual <r>  ratio of mismatching pixels above which the full window is searched (default: 0.05)\n"
                  << std::endl;
     }
 
-    class ImageProcessor {
-       public:
-          virtual ~ImageProcessor() {}
-          virtual bool process( const cv::Mat& frame, bool dropped ) {
-             if ( !dropped ) {
-                if (frame.empty()) {
-                    return false;
-                }
-             }
-             beforeFrame_ = frame.clone();
-             return true;
-          }
-          virtual std::string getTitle() const { return "Unititled"; }
-          const cv::Mat& getBeforeFrame() const { return beforeFrame_; }
-
-       private:
-          cv::Mat beforeFrame_;
-    };
-
-
-    class StaticBackgroundProcessor : public ImageProcessor {
-       public:
-          StaticBackgroundProcessor( int param = 200 ) : pAverageImage_( nullptr ), param_( param ) {}
-          virtual ~StaticBackgroundProcessor() { delete pAverageImage_; }
-          virtual bool process( const cv::Mat& frame, bool dropped ) override {
-             if ( !dropped ) {
-                if (frame.empty()) {
-                   return false;
-                }
-
-                cv::Mat diff(getBeforeFrame().size(), getBeforeFrame().type());
-                cv::absdiff(getBeforeFrame(), frame, diff);
-                cv::Mat grayscaleMat( getBeforeFrame().size(), CV_8U);
-                cv::cvtColor( diff, grayscaleMat, CV_BGR2GRAY );
-                cv::Mat binaryMaskMat(grayscaleMat.size(), grayscaleMat.type());
-                cv::threshold(grayscaleMat, binaryMaskMat, 0, 255, cv::THRESH_BINARY);
-                cv::bitwise_not( binaryMaskMat, binaryMaskMat );
-                cv::Mat doubleGrayscaleMate(getBeforeFrame().size(), CV_64F);
-                binaryMaskMat.convertTo( doubleGrayscaleMate, CV_64F, 1. / 255.);
-
-                if ( !pAverageImage_ ) {
-                   pAverageImage_ = new cv::Mat(frame.size(), CV_64F);
-                }
-
-                // Modifying the avg image
-                double dcounter = counter_;
-                cv::addWeighted( *pAverageImage_, dcounter / ( dcounter + 1. ), doubleGrayscaleMate, 1 / ( dcounter + 1. ), 0., *pAverageImage_ );
-                counter_++;
-
-                imshow("binary", getResult() );
-             }
-
-             ImageProcessor::process( frame, dropped );
-             return true;
-          }
-
-          virtual std::string getTitle() const override { return "Processing"; }
-
-          const cv::Mat getResult() const {
-             assert( pAverageImage_ );
-             cv::Mat resultImage( getBeforeFrame().size(), CV_8U);
-             pAverageImage_->convertTo( resultImage, CV_8U, 255.);
-             cv::threshold(resultImage, resultImage, param_, 255, cv::THRESH_BINARY);
-             return resultImage;
-          }
-       private:
-          cv::Mat* pAverageImage_;
-          int counter_ = 0;
-          int param_;
+    struct Options {
+       std::string input;
+       bool headless = false;
+       bool batch = false;
+       int jobs = 2;
+       int maxThreads = 0;
+       std::string outputDirectory = ".";
+       bool binaryTrajectory = false;
+       std::string debugVideoPrefix;
+       int debugVideoRate = 1;
+       int staticConvergence = 0;
+       bool online = false;
+       int warmup = 300;
+       int lag = 30;
+       size_t frameBudgetInMB = 2048;
+       std::string spillDirectory = "/tmp";
+       int prefetch = 8;
+       std::string cacheDirectory;
+       std::string profileReport;
+       std::string profileTrace;
+       int checkpointInterval = 1000;
+       int carRoi = 0;
+       int staticStride = 1;
+       int dynamicStride = 1;
+       int carStride = 1;
+       int upscale = 1; // 0: detected
+       int downscale = 1;
+       short int maxstep = MAX_STEP;
+       ShiftSearchParameters shiftSearch;
     };
 
-    class DynamicBackgroundProcessor : public ImageProcessor {
-       public:
-          DynamicBackgroundProcessor( std::vector<Vec2f>& trajectory,
-                                      const cv::Mat* pStaticBackground = 0,
-                                      unsigned char maxNumOfSamplesInAverageImage = MAX_NUM_OF_SAMPLES_IN_AVERAGE_IMAGE, int bigMapSize = 1000, short int maxstep = 10, bool mergePreviousDiff = MERGE_PREVIOUS_DIFF )
-           : trajectory_( trajectory ), pStaticBackground_( pStaticBackground ), pPreviousMask_( nullptr ),
-             maxNumOfSamplesInAverageImage_( maxNumOfSamplesInAverageImage ), bigMapRadius_( bigMapSize ), maxstep_( maxstep ), mergePreviousDiff_( mergePreviousDiff )
-          {
-             segmentedBackground_  = Mat::zeros( bigMapRadius_ * 2 + 1, bigMapRadius_ * 2 + 1, CV_64FC3 );
-             numOfSamplesInAverage_= Mat::zeros( bigMapRadius_ * 2 + 1, bigMapRadius_ * 2 + 1, CV_8UC1 );
-             segmentedBackground_.setTo(cv::Scalar(0.0,255.0,0.0));
-             numOfSamplesInAverage_.setTo(cv::Scalar(0));
-          }
-
-          virtual bool process( const cv::Mat& frame, bool dropped ) override {
-             short int dx = 0;
-             short int dy = 0;
-             if ( !dropped ) {
-                if (frame.empty()) {
-                    imwrite( "car_game_background.png", getResult() );
-                    return false;
-                }
-                Mat diff = frame.clone();
-            
-                Mat foregroundMask = calculateShift(getBeforeFrame(), frame, dx, dy);
-                Mat totalMask( foregroundMask.size(), foregroundMask.type() ); 
-                foregroundMask.copyTo( totalMask );
-
-                if ( mergePreviousDiff_ ) {
-                   // Managing previous mask and merging it to total
-                   if ( pPreviousMask_ ) {
-                      cv::bitwise_and( *pPreviousMask_, totalMask, totalMask );
-                   } else {
-                      pPreviousMask_ = new cv::Mat( totalMask.size(), totalMask.type() );
-                   }
-                   foregroundMask.copyTo( *pPreviousMask_ );
-                }
-
-                cv::erode( totalMask, totalMask, getStructuringElement( MORPH_RECT, Size(9,9), Point(5,5) ));
-                addToBackground( getBeforeFrame(), totalMask, ax_, ay_ );
-            
-                ax_ += dx;
-                ay_ += dy;
-            
-                Mat beforeFrame_Masked(getBeforeFrame().size(), getBeforeFrame().type(), cv::Scalar(0,255,0));
-                getBeforeFrame().copyTo( beforeFrame_Masked, totalMask );
-                imshow("binary", beforeFrame_Masked );
-             }
-             trajectory_.push_back( Vec2f( dx, dy ) );
-
-             ImageProcessor::process( frame, dropped );
-            
-             return true;
-          }
-          virtual std::string getTitle() const override { return "Processing"; }
-
-          const cv::Mat getResult() const {
-             cv::Mat resultImage( segmentedBackground_.size(), CV_8UC3);
-             segmentedBackground_.convertTo( resultImage, CV_8UC3);
-             return resultImage;
-          }
-
-       private:
-          // Roboust solution for calculating the shift between two frames after each other
-          cv::Mat calculateShift( const Mat& before, const Mat& after, short int& rx, short int& ry ) {
-             // Creating the diff image, converting it to binary, then dilate a bit -> filtering out areas with exactly the same pixels
-             cv::Mat binaryMaskMat(before.size(), CV_8U);
-             if ( pStaticBackground_ ) {
-                pStaticBackground_->copyTo( binaryMaskMat );
-                cv::bitwise_not( binaryMaskMat, binaryMaskMat );
-             } else {
-                cv::Mat diff(before.size(), before.type());
-                cv::absdiff(before, after, diff);
-                cv::Mat grayscaleMat( before.size(), CV_8U);
-                cv::cvtColor( diff, grayscaleMat, CV_BGR2GRAY );
-                cv::threshold(grayscaleMat, binaryMaskMat, 1, 255, cv::THRESH_BINARY);
-                cv::dilate( binaryMaskMat, binaryMaskMat, getStructuringElement( MORPH_RECT, Size(7,7), Point(3,3) ));
-             }
-  
-             // Do the filter both on the before and on the after image 
-             cv::Mat beforeGrayscale( before.size(), CV_8U );
-             cv::cvtColor( before, beforeGrayscale, CV_BGR2GRAY );
-             cv::Mat beforeGrayscaleMasked( before.size(), CV_8U, cvScalar(0.) );
-             beforeGrayscale.copyTo( beforeGrayscaleMasked, binaryMaskMat );
-  
-             cv::Mat afterGrayscale( after.size(), CV_8U );
-             cv::cvtColor( after, afterGrayscale, CV_BGR2GRAY );
-             cv::Mat afterGrayscaleMasked( after.size(), CV_8U, cvScalar(0.) );
-             afterGrayscale.copyTo( afterGrayscaleMasked, binaryMaskMat );
-  
-             long minimum = 255 * afterGrayscale.cols * afterGrayscale.rows;
-  
-             cv::Mat diffStored(beforeGrayscaleMasked.size(), beforeGrayscaleMasked.type(), cvScalar(0.)); // debug
-  
-             // The claim is that if we apply the correct shift, then the diff image will contain a very few points
-             for ( int ix = -maxstep_; ix <= maxstep_; ++ix ) {
-                for ( int iy = -maxstep_; iy <= maxstep_; ++iy ) {
-                   // had no better idea
-                   int px = ix > 0 ?  ix : 0;
-                   int nx = ix < 0 ? -ix : 0;
-                   int py = iy > 0 ?  iy : 0;
-                   int ny = iy < 0 ? -iy : 0;
-                   int sizex = afterGrayscaleMasked.cols - ( px > nx ? px : nx );
-                   int sizey = afterGrayscaleMasked.rows - ( py > ny ? py : ny );
-                   const cv::Size diffSize( sizex, sizey );
- 
-                   cv::Mat afterGrayscaleMaskedShifted = cv::Mat::zeros(diffSize, afterGrayscaleMasked.type());
-                   afterGrayscaleMasked( cv::Rect(px, py, sizex, sizey) ).copyTo( afterGrayscaleMaskedShifted );
-
-                   cv::Mat beforeGrayscaleMaskedShifted = cv::Mat::zeros(diffSize, beforeGrayscaleMasked.type());
-                   beforeGrayscaleMasked( cv::Rect(nx, ny, sizex, sizey) ).copyTo( beforeGrayscaleMaskedShifted );
-  
-                   cv::Mat diff(diffSize, beforeGrayscaleMasked.type(), cvScalar(0.));
-                   cv::absdiff(beforeGrayscaleMaskedShifted, afterGrayscaleMaskedShifted, diff);
-                   cv::Mat diffBW( after.size(), CV_8U, cvScalar(0.) );
-                   cv::threshold( diff, diffBW, 0, 255, THRESH_BINARY );
-
-                   long pixels = cv::sum( diffBW )[0];
-                   if ( pixels < minimum ) {
-                      rx = -ix; // sorry, I wrote the entire logic in the opposite way and I don't feel like to rewrite everything
-                      ry = -iy;
-                      minimum = pixels;
-                      diff.copyTo( diffStored( cv::Rect(nx, ny, sizex, sizey) ) );
-                   }
-                }
-             }
-
+    bool parseShiftEngine( const std::string& name, ShiftEngine& engine ) {
+       if ( name == "brute" ) {
+          engine = ShiftEngine::BRUTE_FORCE;
+       } else if ( name == "pyramid" ) {
+          engine = ShiftEngine::PYRAMID;
+       } else if ( name == "phase" ) {
+          engine = ShiftEngine::PHASE;
+       } else if ( name == "predictive" ) {
+          engine = ShiftEngine::PREDICTIVE;
+       } else {
+          return false;
+       }
+       return true;
+    }
 
-             cv::Mat diffStoredBW( after.size(), CV_8U, cvScalar(0.) );
-             if ( rx == 0 && ry == 0 ) {
-                return diffStoredBW;
+    bool parseOptions( int ac, char** av, Options& options ) {
+       for ( int i = 1; i < ac; ++i ) {
+          const std::string arg = av[i];
+          if ( arg == "--headless" ) {
+             options.headless = true;
+          } else if ( arg == "--batch" ) {
+             options.batch = true;
+          } else if ( arg == "--jobs" && i + 1 < ac ) {
+             options.jobs = atoi( av[++i] );
+          } else if ( arg == "--max-threads" && i + 1 < ac ) {
+             options.maxThreads = atoi( av[++i] );
+          } else if ( arg == "--output-dir" && i + 1 < ac ) {
+             options.outputDirectory = av[++i];
+          } else if ( arg == "--debug-video" && i + 1 < ac ) {
+             options.debugVideoPrefix = av[++i];
+          } else if ( arg == "--debug-video-rate" && i + 1 < ac ) {
+             options.debugVideoRate = atoi( av[++i] );
+          } else if ( arg == "--binary-trajectory" ) {
+             options.binaryTrajectory = true;
+          } else if ( arg == "--online" ) {
+             options.online = true;
+          } else if ( arg == "--warmup" && i + 1 < ac ) {
+             options.warmup = atoi( av[++i] );
+          } else if ( arg == "--lag" && i + 1 < ac ) {
+             options.lag = atoi( av[++i] );
+          } else if ( arg == "--static-convergence" && i + 1 < ac ) {
+             options.staticConvergence = atoi( av[++i] );
+          } else if ( arg == "--frame-budget" && i + 1 < ac ) {
+             options.frameBudgetInMB = atol( av[++i] );
+          } else if ( arg == "--spill-dir" && i + 1 < ac ) {
+             options.spillDirectory = av[++i];
+          } else if ( arg == "--profile" && i + 1 < ac ) {
+             options.profileReport = av[++i];
+          } else if ( arg == "--trace" && i + 1 < ac ) {
+             options.profileTrace = av[++i];
+          } else if ( arg == "--cache-dir" && i + 1 < ac ) {
+             options.cacheDirectory = av[++i];
+          } else if ( arg == "--checkpoint-interval" && i + 1 < ac ) {
+             options.checkpointInterval = atoi( av[++i] );
+          } else if ( arg == "--prefetch" && i + 1 < ac ) {
+             options.prefetch = atoi( av[++i] );
+          } else if ( arg == "--car-roi" && i + 1 < ac ) {
+             options.carRoi = atoi( av[++i] );
+          } else if ( arg == "--stride" && i + 1 < ac ) {
+             options.staticStride = options.dynamicStride = options.carStride = atoi( av[++i] );
+          } else if ( arg == "--static-stride" && i + 1 < ac ) {
+             options.staticStride = atoi( av[++i] );
+          } else if ( arg == "--dynamic-stride" && i + 1 < ac ) {
+             options.dynamicStride = atoi( av[++i] );
+          } else if ( arg == "--car-stride" && i + 1 < ac ) {
+             options.carStride = atoi( av[++i] );
+          } else if ( arg == "--upscale" && i + 1 < ac ) {
+             options.upscale = std::string( av[++i] ) == "auto" ? 0 : atoi( av[i] );
+          } else if ( arg == "--downscale" && i + 1 < ac ) {
+             options.downscale = atoi( av[++i] );
+          } else if ( arg == "--maxstep" && i + 1 < ac ) {
+             options.maxstep = atoi( av[++i] );
+          } else if ( arg == "--shift-engine" && i + 1 < ac ) {
+             if ( !parseShiftEngine( av[++i], options.shiftSearch.engine ) ) {
+                cerr << "Unknown shift engine: " << av[i] << endl;
+                return false;
              }
-
-             cv::threshold( diffStored, diffStoredBW, 0, 255, THRESH_BINARY ); // threshold: 0, everything that was not in the last round
-             cv::bitwise_not( diffStoredBW, diffStoredBW );
-             cv::bitwise_and( binaryMaskMat, diffStoredBW, diffStoredBW );
-  
-             return diffStoredBW;
+          } else if ( arg == "--pyramid-levels" && i + 1 < ac ) {
+             options.shiftSearch.pyramidLevels = atoi( av[++i] );
+          } else if ( arg == "--phase-min-response" && i + 1 < ac ) {
+             options.shiftSearch.phaseMinResponse = atof( av[++i] );
+          } else if ( arg == "--predictive-radius" && i + 1 < ac ) {
+             options.shiftSearch.predictiveRadius = atoi( av[++i] );
+          } else if ( arg == "--predictive-max-residual" && i + 1 < ac ) {
+             options.shiftSearch.predictiveMaxResidual = atof( av[++i] );
+          } else if ( arg.size() > 2 && arg.substr( 0, 2 ) == "--" ) {
+             cerr << "Unknown option: " << arg << endl;
+             return false;
+          } else if ( options.input.empty() ) {
+             options.input = arg;
+          } else {
+             return false;
           }
+       }
+       // the frames of the dynamic pass are the only ones stored, the other passes pick from them
+       if ( options.staticStride < 1 || options.dynamicStride < 1 || options.carStride < 1
+            || options.staticStride % options.dynamicStride || options.carStride % options.dynamicStride ) {
+          cerr << "The static and the car stride have to be multiples of the dynamic stride" << endl;
+          return false;
+       }
+       if ( options.maxstep < 0 ) {
+          cerr << "The maxstep can't be negative" << endl;
+          return false;
+       }
+       if ( options.upscale < 0 || options.downscale < 1 ) {
+          cerr << "The upscale has to be auto or positive, the downscale positive" << endl;
+          return false;
+       }
+       if ( options.online && ( options.staticStride > 1 || options.dynamicStride > 1 || options.carStride > 1 ) ) {
+          cerr << "The strides can't be used in online mode" << endl;
+          return false;
+       }
+       return !options.input.empty();
+    }
 
-          void addToBackground( const Mat& img, const Mat& mask, short int posx, short int posy ) {
-             for(int y=0;y<img.rows;y++) {
-                for(int x=0;x<img.cols;x++) {
-                   if ( mask.at<unsigned char>(y, x) == 255 ) {
-                      const int px = bigMapRadius_ + x + posx;
-                      const int py = bigMapRadius_ + y + posy;
-                      if ( 0 <= px && px < numOfSamplesInAverage_.cols && 0 <= py && py < numOfSamplesInAverage_.rows ) {
-                         unsigned char& numOfSamples = numOfSamplesInAverage_.at<unsigned char>( py, px );
-                         if ( numOfSamples < maxNumOfSamplesInAverageImage_ ) {
-                            for (short int i = 0; i < 3; i++) { 
-                               double dNumOfSamples = static_cast<double>( numOfSamples );
-                               double& elem = segmentedBackground_.at<Vec3d>(py,px)[i];
-                               elem = elem * dNumOfSamples/ ( dNumOfSamples + 1. ) + double ( img.at<Vec3b>(y,x)[i] ) * 1. / ( dNumOfSamples + 1. );
-                            }
-                            numOfSamples++;
-                         }
-                      }
-                   }
-                }
-             }
-          }
+    // Everything the result of the pass depends on besides the video, for the pass cache. The
+    // version has to be increased when the pass itself changes.
+    std::string getStaticPassParameters( const Options& options ) {
+       std::ostringstream parameters;
+       parameters << "static v1 threshold=200 drop=10 convergence=" << options.staticConvergence << " stride=" << options.staticStride
+                  << " upscale=" << options.upscale << " downscale=" << options.downscale;
+       return parameters.str();
+    }
 
-       private:
-          std::vector<Vec2f>& trajectory_;
-          const cv::Mat* pStaticBackground_;
-          cv::Mat* pPreviousMask_;
-          unsigned char maxNumOfSamplesInAverageImage_;
-          int bigMapRadius_;
-          short int maxstep_;
-          const bool mergePreviousDiff_;
-
-          cv::Mat segmentedBackground_;
-          cv::Mat numOfSamplesInAverage_; 
-          int ax_ = 0;
-          int ay_ = 0;
-    };
+    std::string getDynamicPassParameters( const Options& options ) {
+       const ShiftSearchParameters& shiftSearch = options.shiftSearch;
+       std::ostringstream parameters;
+       parameters << getStaticPassParameters( options )
+                  << " dynamic v1 samples=" << MAX_NUM_OF_SAMPLES_IN_AVERAGE_IMAGE << " merge=" << MERGE_PREVIOUS_DIFF
+                  << " maxstep=" << options.maxstep << " engine=" << static_cast<int>( shiftSearch.engine )
+                  << " levels=" << shiftSearch.pyramidLevels << " refine=" << shiftSearch.pyramidRefineRadius
+                  << " phase=" << shiftSearch.phaseMinResponse << " radius=" << shiftSearch.predictiveRadius
+                  << " residual=" << shiftSearch.predictiveMaxResidual << " stride=" << options.dynamicStride;
+       return parameters.str();
+    }
 
-    class CarProcessor : public ImageProcessor {
-       public:
-          CarProcessor( const std::vector<Vec2f>& trajectory,
-                        const cv::Mat& background,
-                        const cv::Mat& sbpResult)
-           : trajectory_( trajectory ),
-             background_( background ),
-             sbpResult_( sbpResult ),
-             centroidDistorted_( sbpResult.cols / 2, sbpResult.rows / 2 ),
-             radius_( ( background.cols - 1 ) / 2 ),
-             ax_( radius_ ),
-             ay_( radius_ )
-          {
-          }
 
-          virtual bool process( const cv::Mat& frame, bool dropped ) override {
-             short int dx = trajectory_[ index_ ][0];
-             short int dy = trajectory_[ index_ ][1];
-             ax_ += dx;
-             ay_ += dy;
-             index_++;
-
-             if ( !dropped ) {
-                if (frame.empty()) {
-                    return false;
-                }
-                cv::Mat backgroundSlice = background_( cv::Rect(ax_, ay_, 320, 200) );
-
-                // creating diff in HSV
-                cv::Mat hsvFrame( frame.size(), CV_8UC3 );
-                cv::cvtColor( frame, hsvFrame, CV_RGB2HSV );
-                cv::Mat hsvBackgroundSlice( backgroundSlice.size(), CV_8UC3 );
-                cv::cvtColor( backgroundSlice, hsvBackgroundSlice, CV_RGB2HSV );
-                cv::Mat diff(frame.size(), frame.type());
-                cv::absdiff( hsvFrame, hsvBackgroundSlice, diff );
-
-                // breaking it into channels
-                std::vector<cv::Mat> diffChannels(3);
-                split(diff, diffChannels);
-
-                // threshold
-                cv::Mat binaryMaskMat(frame.size(), CV_8U);
-                cv::threshold(diffChannels[0], binaryMaskMat, 20, 255, cv::THRESH_BINARY);
-                cv::bitwise_not( binaryMaskMat, binaryMaskMat );
-
-                // better approach for map
-                std::vector<cv::Mat> hsvFrameChannels(3);
-                split(hsvFrame, hsvFrameChannels);
-                std::set<unsigned char> distroBackground;
-                createColorDistribution( hsvFrameChannels[0], binaryMaskMat, 255, distroBackground );
-                cv::Mat binaryMaskMatCarColor(frame.size(), CV_8U, cvScalar(0.));
-
-                cv::bitwise_or( binaryMaskMat, sbpResult_, binaryMaskMat );
-                cv::bitwise_not( binaryMaskMat, binaryMaskMat );
-
-                cv::Point elem;
-                if ( createColorMask( binaryMaskMatCarColor, hsvFrameChannels[0], distroBackground ) ) {
-                   cv::bitwise_or( binaryMaskMatCarColor, sbpResult_, binaryMaskMatCarColor );
-                   cv::bitwise_not( binaryMaskMatCarColor, binaryMaskMatCarColor );
-
-                   // detecting our blob
-                   elem = findNearestBlobInBinaryImage( binaryMaskMatCarColor, centroidDistorted_ );
-                   imshow( "carcolor", binaryMaskMatCarColor );
-                } else {
-                   elem = findNearestBlobInBinaryImage( binaryMaskMat, centroidDistorted_ );
-                }
-
-                // distortion removal, basic version, TODO: improve
-                const double distortion = static_cast<double>( binaryMaskMat.cols ) * 3. / 4. / static_cast<double>( binaryMaskMat.rows );
-                cv::Size undistortedSize( binaryMaskMat.cols, binaryMaskMat.rows * distortion );
-
-                if ( elem != cv::Point( 0, 0 ) ) {
-                   cv::floodFill( binaryMaskMat, elem, cvScalar(127.0) );  
-                   cv::Point2d centroidDistorted = calculateCentroid( binaryMaskMat );
-
-                   // remove distortion
-                   cv::resize( binaryMaskMat, binaryMaskMat, undistortedSize );
-                   cv::Point2d centroid = calculateCentroid( binaryMaskMat );
-                   const long area = calculateArea( binaryMaskMat );
-                   averageArea_ = ( averageArea_ * areaSamples_ + area ) / ( areaSamples_ + 1 );
-                   ++areaSamples_;
-                   const bool validArea = ( area > averageArea_ / 1.25 ) && ( area < averageArea_ * 1.25 );
-                   // absolute position
-                   cv::Point2d absPos( ax_ + centroidDistorted.x, ( ay_ + centroidDistorted.y ) * distortion );
-
-                   // orientation
-                   const double rawAngle = 0.5 * atan( 2.0 * calculateMoment( binaryMaskMat, centroid, 1, 1 ) / ( calculateMoment( binaryMaskMat, centroid, 2, 0 ) - calculateMoment( binaryMaskMat, centroid, 0, 2 ) ) );
-                   const double signOfAngle = calculateSignOfAngle( binaryMaskMat, centroid, rawAngle );
-                   const double jOfAngle = calculateJ( binaryMaskMat, centroid, rawAngle, signOfAngle );
-                   cv::Point2d helper = angleVect_;
-                   bool validHelper = false;
-                   if ( places_.size() > 10 ) {
-                      helper = places_[ places_.size() - 1 ] - places_[ places_.size() - 10 ];
-                      validHelper = true;
-                   }
-
-                   const double kOfAngle = estimateKWithHelper( helper, rawAngle, signOfAngle, jOfAngle ); // couldn't calculate K in an exact way
-
-                   double angle = correctInterval( signOfAngle * rawAngle + PI / 2. * jOfAngle + PI * kOfAngle );
-                   bool validAngle = false;
-
-                   // preserving important data
-                   if ( validArea && validHelper 
-                        && ( ( angleVect_.x == 0. && angleVect_.y == 0. )
-                             || ( angleVect_.x * cos( angle )  + angleVect_.y * sin( angle ) > 0.85 )
-                             || ( validAreaCounter_ == 2 ) ) )
-                   {
-                      angleVect_ = cv::Point2d( cos( angle ), sin( angle ) );
-                      validAngle = true;
-                   } else {
-                      if ( angles_.size() ) {
-                         angle = angles_[ angles_.size() - 1 ]; // error correction
-                      }
-                   }
-                   angles_.push_back( angle );
-                   places_.push_back( absPos  );
-                   valid_.push_back( validAngle );
-                   if ( validArea && validHelper ) {
-                      ++validAreaCounter_;
-                   } else {
-                      validAreaCounter_ = 0;
-                   }
-                   centroidDistorted_ = centroidDistorted;
-                   centroid_ = centroid;
-
-                   // drawing debug data
-                   if ( validAngle ) {
-                      cv::Point2d rad( 5, 5 );
-                      cv::rectangle( binaryMaskMat, centroid - rad, centroid + rad, cvScalar(255.0) );
-                   } else {
-                      cv::circle( binaryMaskMat, centroid_, 5, cvScalar(255.0) );
-                   }
-
-                   // visualizing the motion vector == the change of position on the last 10 frames.
-                   {
-                      cv::Point2d endPointOfMotionVector = centroid;
-                      if ( places_.size() > 10 ) {
-                         endPointOfMotionVector += places_[ places_.size() - 1 ] - places_[ places_.size() - 10 ];
-                      }
-                      cv::circle( binaryMaskMat, endPointOfMotionVector, 3, cvScalar(32.0) );
-                   }
-
-                   cv::Point2d dir ( cos( angle + PI ), sin( angle + PI ) );
-                   cv::line( binaryMaskMat, centroid, centroid + cv::Point2d( 30. * dir ), cvScalar(255.0) );
-
-                } else {
-                   centroidDistorted_ = estimateCentroid( binaryMaskMat );
-                   cv::resize( binaryMaskMat, binaryMaskMat, undistortedSize );
-                   centroid_ = estimateCentroid( binaryMaskMat );
-                   cv::circle( binaryMaskMat, centroid_, 5, cvScalar(255.0) );
-                }
-                imshow("binary" , binaryMaskMat );
-             } 
-
-             ImageProcessor::process( frame, dropped );
-            
-             return true;
-          }
-          virtual std::string getTitle() const override { return "Processing"; }
-          void getResult( std::vector<cv::Point2d>& places, std::vector<double>& angles, std::vector<bool>& valid ) const {
-             places = places_;
-             angles = angles_;
-             valid  = valid_;
-          }
+    // The frames are shown at 4:3, see CarProcessor
+    double getDistortion( const cv::Mat& frame ) {
+        return static_cast<double>( frame.cols ) * 3. / 4. / static_cast<double>( frame.rows );
+    }
 
-       private:
-          cv::Point findNearestBlobInBinaryImage( const cv::Mat& img, const cv::Point center ) {
-             const int border = 20;
-             int cx = center.x;
-             int cy = center.y;
-             int maxrad = ( cx < cy ? cx : cy );
-
-             for ( int radius = 0; radius < maxrad; ++radius ) {
-                for ( int x = cx - radius; x <= cx + radius; ++x ) {
-                   for ( int y = cy - radius; y <= cy + radius; ++y ) {
-                      if ( border < x && x < img.cols - border &&
-                           border < y && y < img.rows - border ) {
-                         if ( img.at<unsigned char>( y, x ) == 255 ) {
-                            return cv::Point( x, y );
-                         }
-                      }
-                   }
-                }
-             }
-             return cv::Point( 0, 0 );
-          }
+    // A live capture has no end, in online mode SIGINT ends it like the end of the stream, so the
+    // results are still written
+    volatile std::sig_atomic_t stopRequested = 0;
 
-          cv::Point2d estimateCentroid( const cv::Mat& img ) {
-             cv::Point2d lower( img.cols-1, img.rows-1);
-             cv::Point2d upper( 0.0, 0.0 );
-
-             for ( int x = 0; x < img.cols; ++x ) {
-                for ( int y = 0; y < img.rows; ++y ) {
-                   if ( img.at<unsigned char>( y, x ) > 0 ) {
-                      if ( x > upper.x ) {
-                         upper.x = x;
-                      }
-                      if ( x < lower.x ) {
-                         lower.x = x;
-                      }
-                      if ( y > upper.y ) {
-                         upper.y = y;
-                      }
-                      if ( y < lower.y ) {
-                         lower.y = y;
-                      }
-                   }
-                }
-             }
+    void requestStop(int) {
+        stopRequested = 1;
+    }
 
-             return ( lower + upper ) / 2.;
-          }
+    // Every shift of the window has to leave an overlap of the frames, otherwise the candidates
+    // without one would win by having no mismatching pixel. The window grows with the stride, so on
+    // small analysis frames it is kept below half of the smaller side.
+    short int limitMaxstep( int maxstep, const cv::Mat& frame, std::ostream& log ) {
+        const int limit = ( std::min( frame.cols, frame.rows ) - 1 ) / 2;
+        if ( maxstep > limit ) {
+            log << "The shift window of " << maxstep << " is too large for the " << frame.cols << "x" << frame.rows
+                << " frames, using " << limit << endl;
+            return limit;
+        }
+        return maxstep;
+    }
 
-          long calculateArea( const cv::Mat& img, char centroColor = 127 ) {
-             long area = 0;
+    // Returns true if the user wants to quit
+    bool showAndCheckQuit(const string& window_name, const Mat& frame) {
+        imshow(window_name, frame);
+
+        switch ( (char)waitKey(5) ) {
+            case 'q':
+            case 'Q':
+            case 27: //escape key
+                return true;
+            default:
+                return false;
+        }
+    }
 
-             for ( int x = 0; x < img.cols; ++x ) {
-                for ( int y = 0; y < img.rows; ++y ) {
-                   if ( img.at<unsigned char>( y, x ) == centroColor ) {
-                      ++area;
-                   }
-                }
-             }
+    // The source gives every stride-th frame of the video, the first 10 frames of the video are dropped
+    int processShell(FrameSource& source, ImageProcessor& processor, bool headless, int stride = 1) {
+        string window_name = processor.getTitle();
+        if ( !headless ) {
+           namedWindow(window_name, CV_WINDOW_KEEPRATIO); //resizable window;
+        }
+        Mat frame;
+        source.read( frame );
+          
+        int drop = ( 10 + stride - 1 ) / stride;
+        for (;;) {
+            {
+               PROFILE_SCOPE( "read frame" );
+               source.read( frame );
+            }
+            if ( !processor.process( frame, drop > 0 ) ) {
+               break;
+            }
 
-             return area;
-          }
+            if ( drop > 0 ) {
+               --drop;
+            }
 
-          cv::Point2d calculateCentroid( const cv::Mat& img, char centroColor = 127 ) {
-             double sumx = 0.0;
-             double sumy = 0.0;
-             long num = 0;
-
-             for ( int x = 0; x < img.cols; ++x ) {
-                for ( int y = 0; y < img.rows; ++y ) {
-                   if ( img.at<unsigned char>( y, x ) == centroColor ) {
-                      sumx += x;
-                      sumy += y;
-                      ++num;
-                   }
-                }
-             }
+            if ( headless ) {
+               continue;
+            }
 
-             return cv::Point2d( ( sumx / num ), ( sumy / num ) );
-          }
+            if ( showAndCheckQuit( window_name, frame ) ) {
+               return 1;
+            }
+        }
+        return 0;
+    }
 
-          double calculateMoment( const cv::Mat& img, const cv::Point& centroid, double ordX, double ordY ) {
-             double sum = 0.0;
-             long num = 0;
-
-             for ( int x = 0; x < img.cols; ++x ) {
-                for ( int y = 0; y < img.rows; ++y ) {
-                   if ( img.at<unsigned char>( y, x ) == 127 ) {
-                      sum += pow( x - centroid.x, ordX ) * pow( y - centroid.y, ordY );
-                      ++num;
-                   }
-                }
-             }
+    // Single pass for live sources, which can't be rewound. The static mask is learned from the warm-up
+    // frames, then every frame goes to the background and, with a fixed lag, to the car tracking, so
+    // the panorama already has some samples from the frames after the tracked one. Only the warm-up
+    // and the lag frames are kept in memory, the rows of the trajectory are written as they get final.
+    // The source reads from the decimator, which tells the factor the results are scaled back by.
+    // Quitting or SIGINT ends the capture like the end of the stream. Returns false if the video is
+    // too short for the warm-up.
+    bool processOnline(FrameSource& source, const DecimatingFrameSource& decimator, const Options& options, DebugVideoSink* pDebugSink,
+                      const std::string& backgroundPath, TrajectoryWriter& writer, std::ostream& log, long& numOfFrames) {
+        PROFILE_SCOPE( "online pass" );
+        string window_name = "Processing";
+        if ( !options.headless ) {
+           namedWindow(window_name, CV_WINDOW_KEEPRATIO); //resizable window;
+        }
+        Mat frame;
+        source.read( frame );
 
-             return sum / num;
-          }
+        // the frames are cloned, the source may reuse its buffers
+        std::deque< std::pair<Mat, bool> > warmupFrames;
+        StaticBackgroundProcessor sbp;
+        sbp.setDebugOutput( !options.headless, pDebugSink, "static_" );
+        int drop = 10;
+        while ( static_cast<int>( warmupFrames.size() ) < options.warmup && !stopRequested && source.read( frame ) ) {
+            sbp.process( frame, drop > 0 );
+            warmupFrames.push_back( std::make_pair( frame.clone(), drop > 0 ) );
+            if ( drop > 0 ) {
+               --drop;
+            }
+        }
+        if ( !sbp.getNumOfFrames() ) {
+            log << "The video is too short for the warm-up!" << endl;
+            return false;
+        }
+        cv::Mat sbpResult = sbp.getResult();
+        const int scale = decimator.getFactor();
+        if ( scale > 1 ) {
+            log << "Analysing the frames downscaled by " << scale << endl;
+        }
+        ScalingTrajectoryWriter scaledWriter( writer, scale, getDistortion( sbpResult ) );
+
+        std::vector<Vec2f> trajectory;
+        DynamicBackgroundProcessor dbp( trajectory, &sbpResult, MAX_NUM_OF_SAMPLES_IN_AVERAGE_IMAGE, limitMaxstep( options.maxstep, sbpResult, log ),
+                                        MERGE_PREVIOUS_DIFF, options.shiftSearch );
+        dbp.setDebugOutput( !options.headless, pDebugSink, "dynamic_" );
+        dbp.setBackgroundPath( backgroundPath );
+        dbp.setBackgroundScale( scale );
+        // the panorama is still growing, so the positions are relative to the first frame
+        CarProcessor cp( trajectory, dbp.getPanorama(), sbpResult, cv::Point( 0, 0 ) );
+        cp.setDebugOutput( !options.headless, pDebugSink, "car_" );
+        cp.setWriter( &scaledWriter );
+        cp.setRoiMargin( options.carRoi );
+
+        // The shifts the car tracking went past are removed in chunks, so the memory doesn't grow
+        // with the length of the capture. The dynamic pass needs its last two shifts for the prediction.
+        const int trimChunk = 4096;
+        long numOfTrimmedShifts = 0;
+        std::deque< std::pair<Mat, bool> > delayedFrames;
+        auto feed = [&]( const Mat& elem, bool dropped ) {
+            dbp.process( elem, dropped );
+            delayedFrames.push_back( std::make_pair( elem, dropped ) );
+            if ( static_cast<int>( delayedFrames.size() ) > options.lag ) {
+               cp.process( delayedFrames.front().first, delayedFrames.front().second );
+               delayedFrames.pop_front();
+            }
+            const int consumed = std::min( cp.getNumOfConsumedShifts(), static_cast<int>( trajectory.size() ) - 2 );
+            if ( consumed >= trimChunk ) {
+               trajectory.erase( trajectory.begin(), trajectory.begin() + consumed );
+               cp.forgetShifts( consumed );
+               numOfTrimmedShifts += consumed;
+            }
+        };
 
-          double calculateSignOfAngle( const cv::Mat& img, const cv::Point2d& centroid, double angle ) {
-             int besti = 0;
-             long bestintersect = 0;
-             for ( int i = 0; i <= 1; ++i ) {
-                long intersect = 0;
-                for ( int j = 0; j < 4; ++j ) {
-                   cv::Point2d dir ( cos( static_cast<double>( i* 2.0 - 1.0 ) * angle + PI / 2. * j), sin( static_cast<double>( i* 2.0 - 1.0 ) * angle + PI / 2. * j) );
-                   intersect +=  calculateMirrorIntersect( img, centroid, dir );
-                }
-                if ( intersect > bestintersect ) {
-                   bestintersect = intersect;
-                   besti = i;
-                }
-             }
-             return static_cast<double>(besti) * 2. - 1.;
-          }
+        for ( const auto& elem: warmupFrames ) {
+            feed( elem.first, elem.second );
+        }
+        warmupFrames.clear();
 
-          double calculateJ( const cv::Mat& img, const cv::Point2d& centroid, double angle, double signOfAngle ) {
-             double maxLen = 0.;
-             int maxJ = 0;
-             for ( int j = 0; j < 2; ++j ) {
-                cv::Point2d dir ( cos( signOfAngle * angle + PI / 2. * j), sin( signOfAngle * angle + PI / 2. * j ) );
-                const double len = calculateLen( img, centroid, dir );
-                if ( len > maxLen ) {
-                   maxLen = len;
-                   maxJ = j;
-                }
-             }
-             return maxJ;
-          }
+        while ( !stopRequested && source.read( frame ) ) {
+            feed( frame.clone(), drop > 0 );
+            if ( drop > 0 ) {
+               --drop;
+            }
+            if ( !options.headless && showAndCheckQuit( window_name, frame ) ) {
+               break;
+            }
+        }
 
-          double estimateKWithHelper( const cv::Point2d& helper, double angle, double signOfAngle, double jOfAngle ) {
-             cv::Point2d dir ( cos( signOfAngle * angle + PI / 2. * jOfAngle), sin( signOfAngle * angle + PI / 2. * jOfAngle ) );
-             if ( dir.x * helper.x + dir.y * helper.y > 0 ) {
-                return 1.0;
-             }
-             return 0.0;
-          }
+        // end of the stream, or of the capture
+        dbp.process( Mat(), false );
+        for ( const auto& elem: delayedFrames ) {
+            cp.process( elem.first, elem.second );
+        }
+        cp.process( Mat(), false );
 
-          double correctInterval( double angle ) {
-             while ( angle < 0.0 ) {
-                angle += 2 * PI;
-             }
-             while ( angle > 2 * PI ) {
-                angle -= 2 * PI;
-             }
-             return angle;
-          }
+        numOfFrames = numOfTrimmedShifts + trajectory.size();
+        PROFILE_FRAMES( "online pass", numOfFrames );
+        const cv::Point origin = dbp.getPanorama().getBoundingBox().tl();
+        log << "The positions are relative to the point " << -origin.x * scale << " " << -origin.y * scale << " of the background image" << endl;
+        return true;
+    }
 
-          long calculateMirrorIntersect( const cv::Mat& img, const cv::Point2d& centroid, const cv::Point2d& mir ) {
-             long intersect = 0;
-
-             for ( int x = 0; x < img.cols; ++x ) {
-                for ( int y = 0; y < img.rows; ++y ) {
-                   if ( img.at<unsigned char>( y, x ) == 127 ) {
-                      cv::Point2d dir( x - centroid.x, y - centroid.y );
-                      const double dot = dir.x * mir.x + dir.y * mir.y;
-                      cv::Point2d target = 2.0 * dot * mir - dir;
-
-                      int pointx = target.x + centroid.x;
-                      int pointy = target.y + centroid.y;
-                      if ( 0 <= pointx && pointx < img.cols && 0 <= pointy && pointy < img.rows ) {
-                         if ( img.at<unsigned char>( pointy, pointx ) == 127 ) {
-                            ++intersect;
-                         }
-                      }
-                   }
-                }
-             }
+    // Runs every pass on one video. Returns false on failure, quitting by the user is not a failure.
+    bool processVideo(const std::string& input, const Options& options, size_t frameBudgetInBytes, const std::string& debugVideoPrefix,
+                      const std::string& backgroundPath, TrajectoryWriter& writer, std::ostream& log, long& numOfFrames) {
+        std::unique_ptr<DebugVideoSink> pDebugSink;
+        if ( !debugVideoPrefix.empty() ) {
+            pDebugSink.reset( new DebugVideoSink( debugVideoPrefix, options.debugVideoRate ) );
+        }
 
-             return intersect;
-          }
+        VideoCapture capture(input); //try to open string, this will attempt to open it as a video file
+        if (!capture.isOpened()) //if this fails, try to open as a video camera, through the use of an integer param
+            capture.open(atoi(input.c_str()));
+        if (!capture.isOpened()) {
+            log << "Failed to open a video device or video file!" << endl;
+            return false;
+        }
 
-          long calculateLen( const cv::Mat& img, const cv::Point2d& centroid, cv::Point2d mir ) {
-             double len = 0;
-
-             for ( int x = 0; x < img.cols; ++x ) {
-                for ( int y = 0; y < img.rows; ++y ) {
-                   if ( img.at<unsigned char>( y, x ) == 127 ) {
-                      cv::Point2d dir( x - centroid.x, y - centroid.y );
-                      const double dot = dir.x * mir.x + dir.y * mir.y;
-                      if ( fabs( dot ) > len ) {
-                         len = fabs( dot );
-                      }
-                   }
-                }
-             }
+        if ( options.online ) {
+            CaptureFrameSource captureSource( capture );
+            DecimatingFrameSource decimator( captureSource, options.upscale, options.downscale );
+            if ( options.prefetch > 0 ) {
+               PrefetchingFrameSource prefetcher( decimator, options.prefetch );
+               return processOnline( prefetcher, decimator, options, pDebugSink.get(), backgroundPath, writer, log, numOfFrames );
+            }
+            return processOnline( decimator, decimator, options, pDebugSink.get(), backgroundPath, writer, log, numOfFrames );
+        }
 
-             return len;
-          }
+        // The results of the passes are reused if the content of the video and the parameters match
+        std::unique_ptr<PassCache> pCache;
+        if ( !options.cacheDirectory.empty() ) {
+            pCache.reset( new PassCache( options.cacheDirectory ) );
+            if ( !pCache->open( input ) ) {
+                log << "The input can't be hashed, not using the cache" << endl;
+                pCache.reset();
+            }
+        }
+        const std::string staticParameters = getStaticPassParameters( options );
+        const std::string dynamicParameters = getDynamicPassParameters( options );
+
+        // The video is decoded only once, in the first pass, the other passes are replaying the stored frames
+        FrameStore frameStore( frameBudgetInBytes, options.spillDirectory );
+
+        cv::Mat sbpResult;
+        int scale = 1;
+        const bool staticCached = pCache && pCache->loadStatic( staticParameters, sbpResult );
+        StaticBackgroundProcessor sbp( 200, options.staticConvergence );
+        sbp.setDebugOutput( !options.headless, pDebugSink.get(), "static_" );
+        {
+           PROFILE_SCOPE( "static pass" );
+           CaptureFrameSource captureSource( capture );
+           // only the frames of the dynamic pass are decoded and stored, at the resolution of the analysis
+           StridingFrameSource stridingSource( captureSource, options.dynamicStride );
+           // the frames held for detecting the upscale are charged to the frame budget, the store is still empty then
+           DecimatingFrameSource decimator( stridingSource, options.upscale, options.downscale, std::min<size_t>( frameBudgetInBytes, 64 * 1024 * 1024 ) );
+           FrameStore::Recorder recorder( frameStore, decimator );
+           const int staticStride = options.staticStride / options.dynamicStride;
+           if ( staticCached ) {
+              // only recording
+           } else if ( options.prefetch > 0 ) {
+              // decoding and recording on the decoder thread, the frames it read ahead are stored anyway
+              PrefetchingFrameSource prefetcher( recorder, options.prefetch );
+              StridingFrameSource staticSource( prefetcher, staticStride );
+              if ( processShell(staticSource, sbp, options.headless, options.staticStride) ) {
+                  return true;
+              }
+           } else {
+              StridingFrameSource staticSource( recorder, staticStride );
+              if ( processShell(staticSource, sbp, options.headless, options.staticStride) ) {
+                  return true;
+              }
+           }
+           if ( !recorder.finish() ) {
+               log << "Failed to store the frames of the video!" << endl;
+               return false;
+           }
+           capture.release();
+           scale = decimator.getFactor();
+           if ( options.upscale == 0 ) {
+              log << ( decimator.isDetected() ? "Detected upscale: " : "No upscale detected: " ) << scale / options.downscale << endl;
+           }
+        }
+        PROFILE_FRAMES( "static pass", frameStore.size() );
+        if ( scale > 1 ) {
+           log << "Analysing the frames downscaled by " << scale << endl;
+        }
+        if ( staticCached ) {
+           log << "Static background is loaded from the cache" << endl;
+        } else {
+           sbpResult = sbp.getResult();
+           log << "Static background is based on " << sbp.getNumOfFrames() << " frames" << endl;
+           if ( pCache ) {
+              pCache->storeStatic( staticParameters, sbpResult );
+           }
+        }
 
-          void createColorDistribution( const Mat& img, const Mat& mask, unsigned char maskValue, std::set<unsigned char>& distribution ) const {
-             for(int y=0;y<img.rows;y++) {
-                for(int x=0;x<img.cols;x++) {
-                   if ( mask.at<unsigned char>(y, x) == maskValue ) {
-                      const unsigned char& pixel = img.at<unsigned char>( y, x );
-                      distribution.insert( pixel );
-                   }
-                }
-             }
-          }
+        // the shifts of the skipped frames add up, so the window grows with the stride
+        std::vector<Vec2f> trajectory;
+        DynamicBackgroundProcessor dbp( trajectory, &sbpResult, MAX_NUM_OF_SAMPLES_IN_AVERAGE_IMAGE, limitMaxstep( options.maxstep * options.dynamicStride, sbpResult, log ),
+                                        MERGE_PREVIOUS_DIFF, options.shiftSearch );
+        dbp.setDebugOutput( !options.headless, pDebugSink.get(), "dynamic_" );
+        dbp.setBackgroundPath( backgroundPath );
+        dbp.setBackgroundScale( scale );
+        auto loadDynamic = [&]( bool checkpoint ) {
+           return [&, checkpoint]( std::vector<Vec2f>& shifts, Panorama& panorama ) {
+              return pCache->loadDynamic( dynamicParameters, checkpoint, shifts, panorama );
+           };
+        };
+        if ( pCache && dbp.restore( loadDynamic( false ) ) ) {
+           log << "Dynamic background is loaded from the cache" << endl;
+           dbp.writeBackground();
+        } else {
+           if ( pCache ) {
+              if ( dbp.restore( loadDynamic( true ) ) ) {
+                 log << "Resuming the dynamic pass after " << trajectory.size() << " frames" << endl;
+              }
+              dbp.setCheckpoint( options.checkpointInterval, [&]( const std::vector<Vec2f>& shifts, const Panorama& panorama ) {
+                 pCache->storeDynamic( dynamicParameters, true, shifts, panorama );
+              } );
+           }
+           PROFILE_SCOPE( "dynamic pass" );
+           FrameStore::Reader reader( frameStore );
+           if ( processShell(reader, dbp, options.headless, options.dynamicStride) ) {
+              return true;
+           }
+           PROFILE_FRAMES( "dynamic pass", frameStore.size() );
+           if ( pCache && pCache->storeDynamic( dynamicParameters, false, trajectory, dbp.getPanorama() ) ) {
+              pCache->removeCheckpoint( dynamicParameters );
+           }
+        }
+        numOfFrames = trajectory.size();
+        if ( options.shiftSearch.engine == ShiftEngine::PHASE || options.shiftSearch.engine == ShiftEngine::PREDICTIVE ) {
+           log << "Fell back to the full window search on " << dbp.getNumOfShiftFallbacks() << " frames" << endl;
+        }
+        if ( dbp.getNumOfShiftCalculations() ) {
+           log << "Shift candidates per frame: " << static_cast<double>( dbp.getNumOfShiftCandidates() ) / dbp.getNumOfShiftCalculations() << endl;
+        }
 
-          bool createColorMask( Mat& mask, const Mat& img, std::set<unsigned char>& background ) const {
-             bool success = false;
-             for(int y=0;y<img.rows;y++) {
-                for(int x=0;x<img.cols;x++) {
-                   const unsigned char& pixel = img.at<unsigned char>( y, x );
-                   unsigned char& maskPixel = mask.at<unsigned char>( y, x );
-                   if ( background.count( pixel ) ) {
-                      maskPixel = 255;
-                      success = true;
-                   }
-                }
-             }
-             return success;
-          }
+        CarProcessor cp( trajectory, dbp.getPanorama(), sbpResult, dbp.getPanorama().getBoundingBox().tl() );
+        cp.setDebugOutput( !options.headless, pDebugSink.get(), "car_" );
+        ScalingTrajectoryWriter scaledWriter( writer, scale, getDistortion( sbpResult ) );
+        cp.setWriter( &scaledWriter );
+        cp.setRoiMargin( options.carRoi );
+        cp.setStride( options.carStride / options.dynamicStride, options.dynamicStride );
+        {
+           PROFILE_SCOPE( "car pass" );
+           FrameStore::Reader reader( frameStore );
+           StridingFrameSource carSource( reader, options.carStride / options.dynamicStride );
+           if ( processShell(carSource, cp, options.headless, options.carStride) ) {
+              return true;
+           }
+           PROFILE_FRAMES( "car pass", frameStore.size() );
+        } 
+        if ( options.carRoi > 0 ) {
+           log << "Fell back to the full frame car search on " << cp.getNumOfRoiFallbacks() << " frames" << endl;
+        }
 
-          const std::vector<Vec2f>& trajectory_;
-          const cv::Mat& background_;
-          const cv::Mat& sbpResult_;
-          cv::Point2d centroidDistorted_;
-          cv::Point2d centroid_;
-          cv::Point2d angleVect_;
-          int radius_;
-          int ax_;
-          int ay_;
-          double averageArea_ = 0.;
-          long areaSamples_ = 0;
-          int index_ = 0;
-          long validAreaCounter_ = 0;
-          std::vector<double> angles_;
-          std::vector<cv::Point2d> places_;
-          std::vector<bool> valid_;
-
-          static constexpr double PI = 3.141592653589793;
-    };
+        return true;
+    }
 
-    int processShell(VideoCapture& capture, ImageProcessor& processor) {
-        string window_name = processor.getTitle();
-        namedWindow(window_name, CV_WINDOW_KEEPRATIO); //resizable window;
-        Mat frame;
-        Mat before;
-        capture >> frame;
-          
-        int drop = 10;
-        for (;;) {
-            capture >> frame;
-            if ( !processor.process( frame, drop > 0 ) ) {
-               break;
+    // Every video gets its own outputs, named after the video. The threads and the frame budget
+    // are shared by the jobs.
+    int processBatch(const Options& options) {
+        std::vector<std::string> inputs;
+        if ( !BatchRunner::listInputs( options.input, inputs ) ) {
+            cerr << "Failed to list the inputs in " << options.input << endl;
+            return 1;
+        }
+        std::set<std::string> stems;
+        for ( const auto& elem: inputs ) {
+            if ( !stems.insert( BatchRunner::getStem( elem ) ).second ) {
+                cerr << "More inputs are named " << BatchRunner::getStem( elem ) << ", their outputs would collide" << endl;
+                return 1;
             }
+        }
 
-            imshow(window_name, frame);
-
-            if ( drop > 0 ) {
-               --drop;
+        const int jobs = std::max( 1, options.jobs );
+        const int maxThreads = options.maxThreads > 0 ? options.maxThreads : cv::getNumberOfCPUs();
+        cv::setNumThreads( std::max( 1, maxThreads / jobs ) );
+        const size_t frameBudgetInBytes = options.frameBudgetInMB * 1024 * 1024 / jobs;
+
+        Options jobOptions = options;
+        jobOptions.headless = true; // HighGUI windows can't be used from the workers
+
+        BatchRunner runner( jobs, cerr );
+        const auto results = runner.run( inputs, [&]( const std::string& input, std::ostream& log, long& numOfFrames ) {
+            const std::string prefix = options.outputDirectory + "/" + BatchRunner::getStem( input );
+            const std::string debugVideoPrefix = options.debugVideoPrefix.empty() ? "" : options.debugVideoPrefix + "_" + BatchRunner::getStem( input );
+            if ( options.binaryTrajectory ) {
+                BinaryTrajectoryWriter writer( prefix + "_trajectory.bin" );
+                return writer.isGood()
+                    && processVideo( input, jobOptions, frameBudgetInBytes, debugVideoPrefix, prefix + "_background.png", writer, log, numOfFrames )
+                    && writer.close();
             }
-
-            switch ( (char)waitKey(5) ) {
-                case 'q':
-                case 'Q':
-                case 27: //escape key
-                    return 1;
-                default:
-                    break;
+            std::ofstream trajectoryFile( ( prefix + "_trajectory.txt" ).c_str() );
+            if ( !trajectoryFile ) {
+                log << "Failed to create " << prefix << "_trajectory.txt" << endl;
+                return false;
+            }
+            TextTrajectoryWriter writer( trajectoryFile );
+            return processVideo( input, jobOptions, frameBudgetInBytes, debugVideoPrefix, prefix + "_background.png", writer, log, numOfFrames )
+                && trajectoryFile.good();
+        } );
+        runner.printSummary( results );
+
+        for ( const auto& elem: results ) {
+            if ( !elem.success ) {
+                return 1;
             }
         }
         return 0;
     }
 
+    int processSingle(const Options& options, char** av) {
+        std::unique_ptr<TrajectoryWriter> pWriter;
+        if ( options.binaryTrajectory ) {
+            pWriter.reset( new BinaryTrajectoryWriter( "car_game_trajectory.bin" ) );
+        } else {
+            pWriter.reset( new TextTrajectoryWriter( std::cout ) );
+        }
+        long numOfFrames = 0;
+        if ( !processVideo( options.input, options, options.frameBudgetInMB * 1024 * 1024, options.debugVideoPrefix,
+                            "car_game_background.png", *pWriter, cerr, numOfFrames ) ) {
+            help(av);
+            return 1;
+        }
+        if ( options.binaryTrajectory && !static_cast<BinaryTrajectoryWriter&>( *pWriter ).close() ) {
+            return 1;
+        }
+        return 0;
+    }
+
 }
 
 int main(int ac, char** av) {
 
-    if (ac != 2) {
+    Options options;
+    if ( !parseOptions( ac, av, options ) || options.input.empty() ) {
         help(av);
         return 1;
     }
-    std::string arg = av[1];
-
-    StaticBackgroundProcessor sbp;
-    {
-       VideoCapture capture(arg); //try to open string, this will attempt to open it as a video file
-       if (!capture.isOpened()) //if this fails, try to open as a video camera, through the use of an integer param
-           capture.open(atoi(arg.c_str()));
-       if (!capture.isOpened()) {
-           cerr << "Failed to open a video device or video file!\n" << endl;
-           help(av);
-           return 1;
-       }
-
-       if ( processShell(capture, sbp) ) {
-           return 0;
-       }
-       capture.release();
 
+    if ( ( !options.profileReport.empty() || !options.profileTrace.empty() ) && !Profiler::isEnabled() ) {
+        cerr << "Built without profiling, --profile and --trace need make PROFILE=1" << endl;
+    }
+    Profiler::getInstance().enableTrace( Profiler::isEnabled() && !options.profileTrace.empty() );
+    if ( options.online ) {
+        std::signal( SIGINT, requestStop );
     }
-    cv::Mat sbpResult = sbp.getResult();
-
-    std::vector<Vec2f> trajectory;
-    DynamicBackgroundProcessor dbp( trajectory, &sbpResult );
-    {
-       VideoCapture capture(arg); //try to open string, this will attempt to open it as a video file
-       if (!capture.isOpened()) //if this fails, try to open as a video camera, through the use of an integer param
-           capture.open(atoi(arg.c_str()));
-       if (!capture.isOpened()) {
-           cerr << "Failed to open a video device or video file!\n" << endl;
-           help(av);
-           return 1;
-       }
 
-       if ( processShell(capture, dbp) ) {
-          return 0;
-       }
+    const int result = options.batch ? processBatch( options ) : processSingle( options, av );
 
-       capture.release();
-    } 
-    cv::Mat dbpResult = dbp.getResult();
-
-    CarProcessor cp( trajectory, dbpResult, sbpResult );
-    {
-       VideoCapture capture(arg); //try to open string, this will attempt to open it as a video file
-       if (!capture.isOpened()) //if this fails, try to open as a video camera, through the use of an integer param
-           capture.open(atoi(arg.c_str()));
-       if (!capture.isOpened()) {
-           cerr << "Failed to open a video device or video file!\n" << endl;
-           help(av);
-           return 1;
-       }
-
-       if ( processShell(capture, cp) ) {
-          return 0;
-       }
-
-       capture.release();
-    } 
-
-    // printing the results
-    std::cout << "X Y ANGLE VALID" << std::endl;
-    std::vector<cv::Point2d> places;
-    std::vector<double>      angle;
-    std::vector<bool>        valid;
-    cp.getResult( places, angle, valid );
-    for ( unsigned int i = 0; i < places.size(); ++i ) {
-       std::cout << std::fixed << std::setprecision(5) << places[i].x << " " << places[i].y << " " << angle[i] << " " << valid[i] << std::endl;
+    if ( Profiler::isEnabled() ) {
+        if ( !options.profileReport.empty() && !Profiler::getInstance().writeReport( options.profileReport ) ) {
+            cerr << "Failed to write " << options.profileReport << endl;
+        }
+        if ( !options.profileTrace.empty() && !Profiler::getInstance().writeTrace( options.profileTrace ) ) {
+            cerr << "Failed to write " << options.profileTrace << endl;
+        }
     }
-
-    return 0;
+    return result;
 }
@@ -0,0 +1,115 @@
+// mismatch_bench
+// --------------
+// Compares the ways of scoring the shift candidates of DynamicBackgroundProcessor: the original
+// absdiff -> threshold -> sum chain of OpenCV, the scalar and the SIMD mismatch counter, and the
+// SIMD counter stopping at the best candidate so far, on a full +-10 window.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "MismatchKernel.h"
+
+namespace {
+   const int MAX_STEP = 10;
+
+   void shiftedRects( const cv::Size& size, int ix, int iy, cv::Rect& beforeRect, cv::Rect& afterRect ) {
+      const int sizex = size.width  - abs( ix );
+      const int sizey = size.height - abs( iy );
+      afterRect  = cv::Rect( ix > 0 ? ix : 0, iy > 0 ? iy : 0, sizex, sizey );
+      beforeRect = cv::Rect( ix < 0 ? -ix : 0, iy < 0 ? -iy : 0, sizex, sizey );
+   }
+
+   long scoreWithOpenCV( const cv::Mat& before, const cv::Mat& after, int ix, int iy, long ) {
+      cv::Rect beforeRect, afterRect;
+      shiftedRects( after.size(), ix, iy, beforeRect, afterRect );
+      cv::Mat afterShifted = cv::Mat::zeros( afterRect.size(), after.type() );
+      after( afterRect ).copyTo( afterShifted );
+      cv::Mat beforeShifted = cv::Mat::zeros( beforeRect.size(), before.type() );
+      before( beforeRect ).copyTo( beforeShifted );
+      cv::Mat diff( afterRect.size(), before.type(), cvScalar(0.) );
+      cv::absdiff( beforeShifted, afterShifted, diff );
+      cv::Mat diffBW( after.size(), CV_8U, cvScalar(0.) );
+      cv::threshold( diff, diffBW, 0, 255, cv::THRESH_BINARY );
+      return cv::sum( diffBW )[0] / 255;
+   }
+
+   long scoreWithScalar( const cv::Mat& before, const cv::Mat& after, int ix, int iy, long limit ) {
+      cv::Rect beforeRect, afterRect;
+      shiftedRects( after.size(), ix, iy, beforeRect, afterRect );
+      return countMismatchesScalar( before.ptr( beforeRect.y ) + beforeRect.x, before.step, after.ptr( afterRect.y ) + afterRect.x, after.step,
+                                    afterRect.width, afterRect.height, limit );
+   }
+
+   long scoreWithKernel( const cv::Mat& before, const cv::Mat& after, int ix, int iy, long limit ) {
+      cv::Rect beforeRect, afterRect;
+      shiftedRects( after.size(), ix, iy, beforeRect, afterRect );
+      return countMismatches( before.ptr( beforeRect.y ) + beforeRect.x, before.step, after.ptr( afterRect.y ) + afterRect.x, after.step,
+                              afterRect.width, afterRect.height, limit );
+   }
+
+   // Masked grayscale like frames: blocky texture, black HUD stripe, the after frame is shifted by ( 3, -2 )
+   void createFrames( const cv::Size& size, cv::Mat& before, cv::Mat& after ) {
+      cv::Mat world( size.height + 2 * MAX_STEP, size.width + 2 * MAX_STEP, CV_8U );
+      for ( int y = 0; y < world.rows; ++y ) {
+         for ( int x = 0; x < world.cols; ++x ) {
+            world.at<unsigned char>( y, x ) = ( ( x / 4 ) * 7 + ( y / 4 ) * 13 + rand() % 3 ) % 251;
+         }
+      }
+      before = world( cv::Rect( MAX_STEP, MAX_STEP, size.width, size.height ) ).clone();
+      after  = world( cv::Rect( MAX_STEP + 3, MAX_STEP - 2, size.width, size.height ) ).clone();
+      before( cv::Rect( 0, 0, size.width, size.height / 10 ) ).setTo( cv::Scalar( 0 ) );
+      after( cv::Rect( 0, 0, size.width, size.height / 10 ) ).setTo( cv::Scalar( 0 ) );
+   }
+
+   // Runs a full window search, returns nanoseconds per candidate
+   template <class Score>
+   double benchmark( const cv::Mat& before, const cv::Mat& after, Score score, bool earlyTermination, int repeat, int& bestix, int& bestiy ) {
+      const auto start = std::chrono::steady_clock::now();
+      for ( int r = 0; r < repeat; ++r ) {
+         long minimum = LONG_MAX;
+         for ( int ix = -MAX_STEP; ix <= MAX_STEP; ++ix ) {
+            for ( int iy = -MAX_STEP; iy <= MAX_STEP; ++iy ) {
+               const long pixels = score( before, after, ix, iy, earlyTermination ? minimum : LONG_MAX );
+               if ( pixels < minimum ) {
+                  minimum = pixels;
+                  bestix = ix;
+                  bestiy = iy;
+               }
+            }
+         }
+      }
+      const auto end = std::chrono::steady_clock::now();
+      const double candidates = static_cast<double>( repeat ) * ( 2 * MAX_STEP + 1 ) * ( 2 * MAX_STEP + 1 );
+      return std::chrono::duration<double, std::nano>( end - start ).count() / candidates;
+   }
+}
+
+int main( int argc, char** argv ) {
+   const int repeat = argc > 1 ? atoi( argv[1] ) : 20;
+   const cv::Size sizes[] = { cv::Size( 320, 200 ), cv::Size( 640, 400 ) };
+
+   std::cout << "Mismatch kernel: " << getMismatchKernelName() << std::endl;
+   for ( const cv::Size& size: sizes ) {
+      cv::Mat before, after;
+      createFrames( size, before, after );
+
+      int ix = 0, iy = 0;
+      const double opencv = benchmark( before, after, scoreWithOpenCV, false, repeat, ix, iy );
+      const double scalar = benchmark( before, after, scoreWithScalar, false, repeat, ix, iy );
+      const double simd   = benchmark( before, after, scoreWithKernel, false, repeat, ix, iy );
+      const double early  = benchmark( before, after, scoreWithKernel, true,  repeat, ix, iy );
+
+      std::cout << size.width << "x" << size.height << " (best shift " << ix << " " << iy << "), ns/candidate:" << std::endl
+                << std::fixed << std::setprecision(1)
+                << "   opencv chain:         " << std::setw(10) << opencv << std::endl
+                << "   scalar:               " << std::setw(10) << scalar << "  x" << opencv / scalar << std::endl
+                << "   simd:                 " << std::setw(10) << simd   << "  x" << opencv / simd << std::endl
+                << "   simd + early exit:    " << std::setw(10) << early  << "  x" << opencv / early << std::endl;
+   }
+   return 0;
+}
@@ -0,0 +1,134 @@
+// processor_bench
+// ---------------
+// Measures the kernels of the processors one by one on generated frames at a few resolutions:
+// the shift estimation and the panorama update of DynamicBackgroundProcessor, the colour model,
+// blob search, blob statistics and mirror tests of CarProcessor. Run it with make bench.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "DynamicBackgroundProcessor.h"
+#include "CarProcessor.h"
+
+namespace {
+   // Textured track with a stripe of HUD, the after frame is shifted by ( 3, -2 )
+   void createFrames( const cv::Size& size, cv::Mat& before, cv::Mat& after ) {
+      cv::Mat world( size.height + 2 * MAX_STEP, size.width + 2 * MAX_STEP, CV_8UC3 );
+      for ( int y = 0; y < world.rows; ++y ) {
+         for ( int x = 0; x < world.cols; ++x ) {
+            const unsigned char value = ( ( x / 4 ) * 7 + ( y / 4 ) * 13 + rand() % 3 ) % 251;
+            world.at<cv::Vec3b>( y, x ) = cv::Vec3b( value, 255 - value, ( value * 3 ) % 256 );
+         }
+      }
+      before = world( cv::Rect( MAX_STEP, MAX_STEP, size.width, size.height ) ).clone();
+      after  = world( cv::Rect( MAX_STEP + 3, MAX_STEP - 2, size.width, size.height ) ).clone();
+      before( cv::Rect( 0, 0, size.width, size.height / 10 ) ).setTo( cv::Scalar( 0, 0, 0 ) );
+      after( cv::Rect( 0, 0, size.width, size.height / 10 ) ).setTo( cv::Scalar( 0, 0, 0 ) );
+   }
+
+   // A rotated car sized rectangle of 255 on 0, 40 pixels right from the center
+   cv::Mat createCarMask( const cv::Size& size ) {
+      cv::Mat mask = cv::Mat::zeros( size, CV_8U );
+      const double cx = size.width / 2 + 40., cy = size.height / 2.;
+      const double halfLength = size.width / 40., halfWidth = size.width / 80.;
+      const double c = cos( 0.5 ), s = sin( 0.5 );
+      for ( int y = 0; y < size.height; ++y ) {
+         for ( int x = 0; x < size.width; ++x ) {
+            const double u = ( x - cx ) * c + ( y - cy ) * s;
+            const double v = -( x - cx ) * s + ( y - cy ) * c;
+            if ( fabs( u ) <= halfLength && fabs( v ) <= halfWidth ) {
+               mask.at<unsigned char>( y, x ) = 255;
+            }
+         }
+      }
+      return mask;
+   }
+
+   // Nanoseconds per call
+   template <class Kernel>
+   double measure( int repeat, Kernel kernel ) {
+      kernel(); // warming up
+      const auto start = std::chrono::steady_clock::now();
+      for ( int r = 0; r < repeat; ++r ) {
+         kernel();
+      }
+      return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() / repeat;
+   }
+
+   void report( const char* kernel, const cv::Size& size, double ns ) {
+      std::cout << "   " << std::left << std::setw(34) << kernel << std::right << std::fixed
+                << std::setprecision(0) << std::setw(14) << ns << " ns/frame"
+                << std::setprecision(1) << std::setw(10) << size.area() * 1e3 / ns << " Mpixel/s" << std::endl;
+   }
+}
+
+class ProcessorBenchmark {
+public:
+   static void run( const cv::Size& size, int repeat ) {
+      cv::Mat before, after;
+      createFrames( size, before, after );
+      const cv::Mat staticMask = cv::Mat::zeros( size, CV_8U );
+      std::cout << size.width << "x" << size.height << ":" << std::endl;
+
+      // DynamicBackgroundProcessor
+      {
+         std::vector<cv::Vec2f> trajectory;
+         DynamicBackgroundProcessor dbp( trajectory, &staticMask );
+         dbp.setDebugOutput( false, nullptr, "" );
+         short int dx = 0, dy = 0;
+         report( "calculateShift (brute force)", size, measure( repeat, [&]() { dbp.calculateShift( before, after, dx, dy ); } ) );
+         const cv::Mat mask( size, CV_8U, cv::Scalar( 255 ) );
+         report( "addToBackground", size, measure( repeat, [&]() { dbp.addToBackground( before, mask, dx, dy ); } ) );
+      }
+
+      // CarProcessor
+      {
+         std::vector<cv::Vec2f> trajectory;
+         Panorama panorama;
+         CarProcessor cp( trajectory, panorama, staticMask, cv::Point( 0, 0 ) );
+         cp.setDebugOutput( false, nullptr, "" );
+
+         cv::Mat hsv;
+         cv::cvtColor( before, hsv, CV_RGB2HSV );
+         std::vector<cv::Mat> channels;
+         cv::split( hsv, channels );
+         const cv::Mat backgroundMask = createCarMask( size ) == 0;
+         cv::Mat hues, colorMask;
+         report( "createColorDistribution", size, measure( repeat, [&]() { cp.createColorDistribution( channels[0], backgroundMask, 255, hues ); } ) );
+         report( "createColorMask", size, measure( repeat, [&]() { cp.createColorMask( colorMask, channels[0], hues ); } ) );
+
+         const cv::Mat carMask = createCarMask( size );
+         const cv::Rect frameRect( 0, 0, size.width, size.height );
+         const cv::Point center( size.width / 2, size.height / 2 );
+         report( "findNearestBlob (40 px away)", size, measure( repeat, [&]() { cp.findNearestBlobInBinaryImage( carMask, center, frameRect, size ); } ) );
+         const cv::Mat emptyMask = cv::Mat::zeros( size, CV_8U );
+         report( "findNearestBlob (not found)", size, measure( repeat, [&]() { cp.findNearestBlobInBinaryImage( emptyMask, center, frameRect, size ); } ) );
+
+         cv::Mat blobMask = carMask.clone();
+         blobMask.setTo( cv::Scalar( 127 ), carMask );
+         report( "calculateBlobStats", size, measure( repeat, [&]() { cp.calculateBlobStats( blobMask, frameRect ); } ) );
+         const CarProcessor::BlobStats blob = cp.calculateBlobStats( blobMask, frameRect, true );
+         const double rawAngle = 0.5 * atan( 2.0 * blob.mu11 / ( blob.mu20 - blob.mu02 ) );
+         report( "calculateBlobStats with pixels", size, measure( repeat, [&]() { cp.calculateBlobStats( blobMask, frameRect, true ); } ) );
+         report( "calculateSignOfAngle (8 mirrors)", size, measure( repeat, [&]() { cp.calculateSignOfAngle( blob, blob.centroid, rawAngle ); } ) );
+         report( "calculateJ", size, measure( repeat, [&]() { cp.calculateJ( blob, blob.centroid, rawAngle, 1. ); } ) );
+      }
+   }
+};
+
+int main( int argc, char** argv ) {
+   const int repeat = argc > 1 ? atoi( argv[1] ) : 20;
+   const cv::Size sizes[] = { cv::Size( 320, 200 ), cv::Size( 640, 400 ), cv::Size( 1280, 800 ) };
+
+   std::cout << "Mismatch kernel: " << getMismatchKernelName() << ", " << repeat << " repeats" << std::endl;
+   for ( const cv::Size& size: sizes ) {
+      ProcessorBenchmark::run( size, repeat );
+   }
+   return 0;
+}
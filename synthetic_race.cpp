@@ -0,0 +1,347 @@
+// synthetic_race
+// --------------
+// Renders a top-down race without a window: CarPhysics drives the car along a scripted input
+// sequence, the camera scrolls a tiled background after it, a static HUD covers the top of the
+// frame. Writes the video and the ground truth of every frame, so the extractor can be measured
+// against known positions on workloads of any length and resolution.
+//
+// The pixels are not square, the frame is shown at 4:3 like the original game, the same way the
+// extractor undistorts it. The ground truth is in the undistorted coordinates of the extractor,
+// relative to the top left corner of the first frame (the extractor reports relative to the top
+// left corner of its background image, the difference is a constant offset). The angle is the
+// heading of the car in radians, in [0, 2 PI).
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <memory>
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "Positioned.h"
+#include "CarPhysics.h"
+#include "TrajectoryWriter.h"
+#include "TrajectoryFile.h"
+
+namespace {
+   const double PI = 3.141592653589793;
+   const int REFERENCE_WIDTH = 320; // the sizes of the scene are given at this width
+
+   void help( char** argv ) {
+      std::cout << "\nRenders a synthetic race video and its ground truth\n"
+                << "Usage: " << argv[0] << " [options] <output prefix>\n"
+                << "Writes <prefix>.avi and <prefix>_truth.txt (<prefix>_truth.bin with --binary-truth)\n"
+                << "Options:\n"
+                << "  --frames <n>          number of frames (default: 3000)\n"
+                << "  --size <w>x<h>        frame size (default: 320x200)\n"
+                << "  --fps <n>             frames per second of the video and of the physics (default: 25)\n"
+                << "  --scale <s>           pixels per unit of CarPhysics at 320 pixels wide frames (default: 0.25)\n"
+                << "  --seed <n>            seed of the background texture and of the generated script (default: 1)\n"
+                << "  --script <file>       input sequence, lines of \"<duration in ms> <actions>\", actions: a accelerate,\n"
+                << "                        l turn left, r turn right, - nothing (default: generated from the seed)\n"
+                << "  --fourcc <code>       codec of the video (default: MJPG)\n"
+                << "  --binary-truth        writing the ground truth into the binary trajectory file, with the shifts\n"
+                << "  --no-video            rendering without encoding, for measuring the generator itself\n"
+                << std::endl;
+   }
+
+   struct Options {
+      std::string prefix;
+      long frames = 3000;
+      cv::Size size = cv::Size( 320, 200 );
+      int fps = 25;
+      double scale = 0.25;
+      unsigned int seed = 1;
+      std::string script;
+      std::string fourcc = "MJPG";
+      bool binaryTruth = false;
+      bool noVideo = false;
+   };
+
+   bool parseOptions( int argc, char** argv, Options& options ) {
+      for ( int i = 1; i < argc; ++i ) {
+         const std::string arg = argv[i];
+         if ( arg == "--frames" && i + 1 < argc ) {
+            options.frames = atol( argv[++i] );
+         } else if ( arg == "--size" && i + 1 < argc ) {
+            if ( sscanf( argv[++i], "%dx%d", &options.size.width, &options.size.height ) != 2 ) {
+               return false;
+            }
+         } else if ( arg == "--fps" && i + 1 < argc ) {
+            options.fps = atoi( argv[++i] );
+         } else if ( arg == "--scale" && i + 1 < argc ) {
+            options.scale = atof( argv[++i] );
+         } else if ( arg == "--seed" && i + 1 < argc ) {
+            options.seed = strtoul( argv[++i], nullptr, 10 );
+         } else if ( arg == "--script" && i + 1 < argc ) {
+            options.script = argv[++i];
+         } else if ( arg == "--fourcc" && i + 1 < argc ) {
+            options.fourcc = argv[++i];
+         } else if ( arg == "--binary-truth" ) {
+            options.binaryTruth = true;
+         } else if ( arg == "--no-video" ) {
+            options.noVideo = true;
+         } else if ( arg.size() > 2 && arg.compare( 0, 2, "--" ) == 0 ) {
+            return false;
+         } else {
+            options.prefix = arg;
+         }
+      }
+      return !options.prefix.empty() && options.frames > 0 && options.fps > 0 && options.scale > 0.
+             && options.size.width >= 64 && options.size.height >= 64 && options.fourcc.size() == 4;
+   }
+
+   // An endless plain of asphalt, the car never slows down for leaving the track
+   class Asphalt : public Positioned {
+   public:
+      virtual void move( int passed_time_in_ms ) const override {}
+      virtual bool hasAttribute( const std::string& attribute, double x, double y ) const override { return attribute == "asphalt"; }
+   };
+
+   struct ScriptStep {
+      int durationInMs;
+      bool accelerate;
+      int turn; // +1 left, -1 right
+   };
+
+   bool readScript( const std::string& path, std::vector<ScriptStep>& script ) {
+      std::ifstream in( path.c_str() );
+      if ( !in ) {
+         std::cerr << "Can't open script " << path << std::endl;
+         return false;
+      }
+      std::string line;
+      while ( std::getline( in, line ) ) {
+         std::istringstream fields( line );
+         ScriptStep step = { 0, false, 0 };
+         std::string actions;
+         if ( !( fields >> step.durationInMs ) ) {
+            continue; // empty line or comment
+         }
+         fields >> actions;
+         step.accelerate = actions.find( 'a' ) != std::string::npos;
+         step.turn = ( actions.find( 'l' ) != std::string::npos ) - ( actions.find( 'r' ) != std::string::npos );
+         script.push_back( step );
+      }
+      if ( script.empty() ) {
+         std::cerr << "No steps in script " << path << std::endl;
+         return false;
+      }
+      return true;
+   }
+
+   // Mostly full throttle with turns of random length and direction, released now and then
+   std::vector<ScriptStep> generateScript( std::mt19937& random ) {
+      std::vector<ScriptStep> script;
+      for ( int i = 0; i < 64; ++i ) {
+         ScriptStep step;
+         step.durationInMs = 500 + random() % 2500;
+         step.accelerate = random() % 8 != 0;
+         step.turn = static_cast<int>( random() % 3 ) - 1;
+         script.push_back( step );
+      }
+      return script;
+   }
+
+   // Blocks of earth colours, none of them blue, so the hue of the car is not in the background
+   cv::Mat createTexture( int tileSize, int blockSize, std::mt19937& random ) {
+      const cv::Vec3b palette[] = { cv::Vec3b( 40, 90, 60 ), cv::Vec3b( 30, 120, 70 ), cv::Vec3b( 50, 80, 110 ), cv::Vec3b( 60, 100, 140 ),
+                                    cv::Vec3b( 90, 90, 90 ), cv::Vec3b( 110, 110, 110 ), cv::Vec3b( 40, 140, 160 ), cv::Vec3b( 20, 60, 40 ) };
+      const int numOfColors = sizeof( palette ) / sizeof( palette[0] );
+      cv::Mat texture( tileSize, tileSize, CV_8UC3 );
+      for ( int by = 0; by < tileSize; by += blockSize ) {
+         for ( int bx = 0; bx < tileSize; bx += blockSize ) {
+            const cv::Vec3b& color = palette[ random() % numOfColors ];
+            texture( cv::Rect( bx, by, std::min( blockSize, tileSize - bx ), std::min( blockSize, tileSize - by ) ) ).setTo( cv::Scalar( color[0], color[1], color[2] ) );
+         }
+      }
+      return texture;
+   }
+
+   // The tile repeated to cover every frame sized window starting inside the first tile, so a
+   // frame of the background is a single copy
+   cv::Mat createExtendedTexture( const cv::Mat& tile, const cv::Size& size ) {
+      cv::Mat extended( tile.rows + size.height, tile.cols + size.width, tile.type() );
+      for ( int y = 0; y < extended.rows; y += tile.rows ) {
+         for ( int x = 0; x < extended.cols; x += tile.cols ) {
+            const cv::Rect rect = cv::Rect( x, y, tile.cols, tile.rows ) & cv::Rect( 0, 0, extended.cols, extended.rows );
+            tile( cv::Rect( 0, 0, rect.width, rect.height ) ).copyTo( extended( rect ) );
+         }
+      }
+      return extended;
+   }
+
+   cv::Mat createHud( const cv::Size& size ) {
+      cv::Mat hud( size.height / 10, size.width, CV_8UC3, cv::Scalar( 0, 0, 0 ) );
+      const double fontScale = 0.3 * size.width / REFERENCE_WIDTH;
+      cv::putText( hud, "LAP 1/3", cv::Point( hud.cols / 40, hud.rows * 3 / 4 ), cv::FONT_HERSHEY_SIMPLEX, fontScale, cv::Scalar( 255, 255, 255 ) );
+      cv::rectangle( hud, cv::Point( hud.cols / 2, hud.rows / 4 ), cv::Point( hud.cols * 9 / 10, hud.rows * 3 / 4 ), cv::Scalar( 0, 200, 255 ), -1 );
+      return hud;
+   }
+
+   int floorMod( int value, int modulus ) {
+      const int result = value % modulus;
+      return result < 0 ? result + modulus : result;
+   }
+
+   // The body of the car with a narrower front, so it is not symmetric to its width axis.
+   // Points are in 1/16 pixels for fillConvexPoly.
+   void drawCar( cv::Mat& frame, const cv::Point2d& center, double heading, double width, double height, double distortion ) {
+      const double shape[6][2] = { { -0.5, -0.5 }, { 0.5, -0.5 }, { 0.5, 0.25 }, { 0.3, 0.5 }, { -0.3, 0.5 }, { -0.5, 0.25 } };
+      const cv::Point2d forward( cos( heading ), sin( heading ) );
+      const cv::Point2d right( -forward.y, forward.x );
+      cv::Point points[6];
+      for ( int i = 0; i < 6; ++i ) {
+         const cv::Point2d p = center + right * ( shape[i][0] * width ) + forward * ( shape[i][1] * height );
+         points[i] = cv::Point( cvRound( p.x * 16. ), cvRound( p.y / distortion * 16. ) );
+      }
+      cv::fillConvexPoly( frame, points, 6, cv::Scalar( 220, 60, 30 ), 8, 4 );
+   }
+}
+
+int main( int argc, char** argv ) {
+   Options options;
+   if ( !parseOptions( argc, argv, options ) ) {
+      help( argv );
+      return 1;
+   }
+
+   std::mt19937 random( options.seed );
+   std::vector<ScriptStep> script;
+   if ( options.script.empty() ) {
+      script = generateScript( random );
+   } else if ( !readScript( options.script, script ) ) {
+      return 1;
+   }
+
+   const cv::Size& size = options.size;
+   const double pixelsPerUnit = options.scale * size.width / REFERENCE_WIDTH;
+   const double distortion = static_cast<double>( size.width ) * 3. / 4. / static_cast<double>( size.height );
+   const int blockSize = std::max( 1, 4 * size.width / REFERENCE_WIDTH );
+   const cv::Mat extendedTexture = createExtendedTexture( createTexture( 128 * blockSize, blockSize, random ), size );
+   const int tileSize = extendedTexture.cols - size.width;
+   const cv::Mat hud = createHud( size );
+
+   cv::VideoWriter video;
+   if ( !options.noVideo ) {
+      const std::string& c = options.fourcc;
+      if ( !video.open( options.prefix + ".avi", CV_FOURCC( c[0], c[1], c[2], c[3] ), options.fps, size, true ) ) {
+         std::cerr << "Can't open " << options.prefix << ".avi for writing" << std::endl;
+         return 1;
+      }
+   }
+   std::ofstream truthText;
+   std::unique_ptr<TrajectoryWriter> truth;
+   if ( options.binaryTruth ) {
+      truth.reset( new BinaryTrajectoryWriter( options.prefix + "_truth.bin" ) );
+   } else {
+      truthText.open( ( options.prefix + "_truth.txt" ).c_str() );
+      truth.reset( new TextTrajectoryWriter( truthText ) );
+   }
+
+   PositionedContainer world;
+   Asphalt asphalt;
+   world.addChild( asphalt );
+   CarPhysics car( 0., 0., world );
+
+   // The camera follows the car in whole pixels, keeping it in the middle half of the frame
+   // below the HUD. Everything is in undistorted pixels, the camera starts at the origin.
+   const double undistortedHeight = size.height * distortion;
+   const double top = hud.rows * distortion;
+   const cv::Rect_<double> box( size.width / 4., top + ( undistortedHeight - top ) / 4., size.width / 2., ( undistortedHeight - top ) / 2. );
+   cv::Point camera( 0, 0 );
+   const cv::Point2d start( box.x + box.width / 2., box.y + box.height / 2. );
+
+   const double carWidth = car.getParams().getCarWidth() * pixelsPerUnit;
+   const double carHeight = car.getParams().getCarHeight() * pixelsPerUnit;
+   const int frameTimeInMs = 1000 / options.fps;
+   size_t step = 0;
+   int stepTimeInMs = 0;
+   cv::Mat frame( size, CV_8UC3 );
+   double renderSeconds = 0.;
+   const auto begin = std::chrono::steady_clock::now();
+
+   for ( long i = 0; i < options.frames; ++i ) {
+      const auto renderBegin = std::chrono::steady_clock::now();
+      for ( int ms = 0; ms < frameTimeInMs; ++ms ) {
+         const ScriptStep& current = script[ step ];
+         if ( current.accelerate ) {
+            car.accelerate();
+         } else {
+            car.stopAccelerating();
+         }
+         if ( current.turn > 0 ) {
+            car.turnLeft();
+         } else if ( current.turn < 0 ) {
+            car.turnRight();
+         } else {
+            car.stopTurning();
+         }
+         car.move_in_a_millisecond();
+         if ( ++stepTimeInMs >= current.durationInMs ) {
+            stepTimeInMs = 0;
+            step = ( step + 1 ) % script.size();
+         }
+      }
+
+      // the image y axis points down, so the world is seen mirrored, the truth is what is rendered
+      const cv::Point2d position = start + cv::Point2d( car.getX(), car.getY() ) * pixelsPerUnit;
+      const double angleInRad = car.getAngleOfCarOrientation() / 180. * PI;
+      double heading = atan2( cos( angleInRad ), -sin( angleInRad ) );
+      if ( heading < 0. ) {
+         heading += 2. * PI;
+      }
+
+      const cv::Point previousCamera = camera;
+      if ( position.x - camera.x < box.x ) {
+         camera.x = static_cast<int>( floor( position.x - box.x ) );
+      } else if ( position.x - camera.x > box.x + box.width ) {
+         camera.x = static_cast<int>( ceil( position.x - box.x - box.width ) );
+      }
+      // the camera moves in distorted pixels vertically
+      const double cameraY = camera.y * distortion;
+      if ( position.y - cameraY < box.y ) {
+         camera.y = static_cast<int>( floor( ( position.y - box.y ) / distortion ) );
+      } else if ( position.y - cameraY > box.y + box.height ) {
+         camera.y = static_cast<int>( ceil( ( position.y - box.y - box.height ) / distortion ) );
+      }
+
+      extendedTexture( cv::Rect( floorMod( camera.x, tileSize ), floorMod( camera.y, tileSize ), size.width, size.height ) ).copyTo( frame );
+      const cv::Point2d carOnScreen( position.x - camera.x, position.y - camera.y * distortion );
+      drawCar( frame, carOnScreen, heading, carWidth, carHeight, distortion );
+      hud.copyTo( frame( cv::Rect( 0, 0, hud.cols, hud.rows ) ) );
+      renderSeconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - renderBegin ).count();
+
+      if ( !options.noVideo ) {
+         video.write( frame );
+      }
+      truth->write( TrajectoryRow{ position.x, position.y, heading, true, static_cast<int>( i ),
+                                   static_cast<float>( camera.x - previousCamera.x ), static_cast<float>( camera.y - previousCamera.y ) } );
+   }
+
+   bool good = true;
+   if ( options.binaryTruth ) {
+      good = static_cast<BinaryTrajectoryWriter*>( truth.get() )->close();
+   } else {
+      good = truthText.good();
+   }
+   if ( !good ) {
+      std::cerr << "Failed to write the ground truth" << std::endl;
+      return 1;
+   }
+
+   const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - begin ).count();
+   std::cout << options.frames << " frames of " << size.width << "x" << size.height << " in " << std::fixed << std::setprecision(2) << seconds << " s, "
+             << std::setprecision(0) << options.frames / seconds << " fps (rendering alone " << options.frames / renderSeconds << " fps)" << std::endl;
+   return 0;
+}
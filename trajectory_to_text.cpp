@@ -0,0 +1,50 @@
+// trajectory_to_text
+// ------------------
+// Prints a binary trajectory file in the text format of the extractor, optionally with the frame
+// index and the shift of the background since the previous row.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include "TrajectoryFile.h"
+
+int main( int argc, char** argv ) {
+   bool withShift = false;
+   std::string path;
+   for ( int i = 1; i < argc; ++i ) {
+      const std::string arg = argv[i];
+      if ( arg == "--with-shift" ) {
+         withShift = true;
+      } else {
+         path = arg;
+      }
+   }
+   if ( path.empty() ) {
+      std::cerr << "Usage: " << argv[0] << " [--with-shift] <trajectory file>" << std::endl;
+      return 1;
+   }
+
+   TrajectoryFileReader reader;
+   if ( !reader.open( path ) ) {
+      return 1;
+   }
+
+   if ( !withShift ) {
+      TextTrajectoryWriter writer( std::cout );
+      for ( size_t i = 0; i < reader.size(); ++i ) {
+         writer.write( reader.at( i ) );
+      }
+      return 0;
+   }
+
+   std::cout << "FRAME X Y ANGLE VALID SHIFTX SHIFTY" << std::endl;
+   for ( size_t g = 0; g < reader.getNumOfRowGroups(); ++g ) {
+      const TrajectoryFileReader::RowGroup& group = reader.getRowGroup( g );
+      for ( size_t i = 0; i < group.numOfRows; ++i ) {
+         std::cout << group.frame[i] << " " << std::fixed << std::setprecision(5) << group.x[i] << " " << group.y[i] << " " << group.angle[i]
+                   << " " << static_cast<int>( group.valid[i] ) << " " << std::setprecision(0) << group.shiftx[i] << " " << group.shifty[i] << "\n";
+      }
+   }
+   return 0;
+}